@@ -6,13 +6,14 @@ using namespace apollo;
 
 using json = nlohmann::json;
 
-/// 配置文件路径
-const std::string& kPath = "config.json";
+/// 配置文件路径，使用常量初始化以便其他编译单元在静态初始化阶段读取配置
+static const char* const kPath = "config.json";
 
 ConfigParser::ConfigParser()
     : parseSuc_(true)
     , rpcConfig_(0)
-    , zkConfig_(0) {
+    , zkConfig_(0)
+    , mempoolConfig_(1024 * 1024) {
     if (!parse(kPath)) {
         std::cout << "failed to load config file!" << std::endl;
         parseSuc_ = false;
@@ -49,6 +50,29 @@ bool ConfigParser::parse(const std::string& path) {
         logConfig_.insert({ name, logConf });
     }
 
+    // 解析内存池配置
+    if (js.find("mempool") != js.end()) {
+        auto& mempool = js["mempool"];
+        if (mempool.find("releaserate") != mempool.end()) {
+            mempool.at("releaserate").get_to(mempoolConfig_.releaseRate);
+        }
+        if (mempool.find("releaseage") != mempool.end()) {
+            mempool.at("releaseage").get_to(mempoolConfig_.releaseAge);
+        }
+        if (mempool.find("releaseinterval") != mempool.end()) {
+            mempool.at("releaseinterval").get_to(mempoolConfig_.releaseInterval);
+        }
+        if (mempool.find("threadcachesize") != mempool.end()) {
+            mempool.at("threadcachesize").get_to(mempoolConfig_.threadCacheSize);
+        }
+        if (mempool.find("heapsamplerate") != mempool.end()) {
+            mempool.at("heapsamplerate").get_to(mempoolConfig_.heapSampleRate);
+        }
+        if (mempool.find("heapprofile") != mempool.end()) {
+            mempool.at("heapprofile").get_to(mempoolConfig_.heapProfile);
+        }
+    }
+
     // 解析RPC节点配置
     if (js.find("rpc") != js.end()) {
         js["rpc"].at("ip").get_to(rpcConfig_.ip);
@@ -77,6 +77,26 @@ public:
         uint16_t    port; // 端口号
     };
 
+    /**
+     * @brief 内存池配置信息
+     */
+    struct MempoolConfig {
+        MempoolConfig() { }
+        MempoolConfig(size_t rate, uint32_t age = 10, uint32_t interval = 1, size_t cacheSize = 32 * 1024 * 1024)
+            : releaseRate(rate)
+            , releaseAge(age)
+            , releaseInterval(interval)
+            , threadCacheSize(cacheSize)
+            , heapSampleRate(0)
+            , heapProfile("apollo") { }
+        size_t      releaseRate;     // 每秒最多归还给操作系统的字节数，为0表示不归还
+        uint32_t    releaseAge;      // 空闲页的最短空闲时间，单位为秒
+        uint32_t    releaseInterval; // 回收线程的执行间隔，单位为秒
+        size_t      threadCacheSize; // 所有ThreadCache缓存的总字节数上限
+        size_t      heapSampleRate;  // 堆分析的平均采样间隔，为0表示不采样
+        std::string heapProfile;     // 收到SIGUSR2信号时输出的堆分析文件的前缀
+    };
+
     /**
      * @brief 数据库类型
      * 
@@ -141,6 +161,13 @@ public:
      */
     const ZookeeperConfig zookeeperConfig() const { return zkConfig_; }
 
+    /**
+     * @brief 获取内存池配置信息
+     * 
+     * @return const MempoolConfig& 
+     */
+    const MempoolConfig& mempoolConfig() const { return mempoolConfig_; }
+
     /**
      * @brief 获取数据库配置信息
      * 
@@ -170,8 +197,9 @@ private:
 
     std::map<std::string, LogConfig> logConfig_; // 日志配置信息
 
-    RpcNodeConfig   rpcConfig_; // RPC节点配置信息
-    ZookeeperConfig zkConfig_;  // ZooKeeper配置信息
+    RpcNodeConfig   rpcConfig_;     // RPC节点配置信息
+    ZookeeperConfig zkConfig_;      // ZooKeeper配置信息
+    MempoolConfig   mempoolConfig_; // 内存池配置信息
 
     std::vector<DatabaseConfig> dbConfig_; // 数据库配置
 };
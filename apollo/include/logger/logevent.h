@@ -2,6 +2,7 @@
 #define __APOLLO_LOG_EVENT_H__
 
 #include "loglevel.h"
+#include "typedpool.h"
 #include <memory>
 #include <sstream>
 #include <string>
@@ -12,8 +13,9 @@ class Logger;
 
 /**
  * @brief 日志事件
+ * @details 每条日志创建一次，由TypedPool分配
  */
-class LogEvent {
+class LogEvent : public PoolAllocated<LogEvent> {
 public:
     /**
      * @brief 构造日志事件
@@ -17,5 +17,33 @@ struct TreeNode {
 void BenchmarkMalloc(size_t ntimes, size_t nworks, size_t rounds);
 /// 测试concurrentAlloc/concurrentFree
 void BenchmarkConcurrentMalloc(size_t ntimes, size_t nworks, size_t rounds);
+/// 测试字节数到哈希桶下标的映射
+void BenchmarkSizeClass(size_t ntimes);
+/// 测试ThreadCache申请和释放的快速路径
+void BenchmarkThreadCache(size_t ntimes);
+
+/// 对比测试所使用的内存分配器
+enum class BenchAllocator {
+    MALLOC, // glibc的malloc/free
+    APOLLO, // concurrentAlloc/concurrentFree
+};
+
+/// 单个场景的测试结果，耗时均为墙上时间
+struct BenchResult {
+    double opsPerSec;     // 每秒完成的申请与释放次数之和
+    double allocNs[3];    // 申请耗时的p50/p99/p999，单位为纳秒
+    double freeNs[3];     // 释放耗时的p50/p99/p999，单位为纳秒
+    size_t peakRssBytes;  // 测试期间进程驻留内存的峰值相对测试开始时的增量
+    size_t peakLiveBytes; // 测试期间同时存活的字节数的峰值
+};
+
+/// 按照线上protobuf消息和Buffer的大小分布申请和释放，每个线程维持固定数目的存活对象
+BenchResult BenchmarkSizeMix(BenchAllocator allocator, size_t nops, size_t nworks);
+/// 生产者线程申请、消费者线程释放，测试跨线程释放
+BenchResult BenchmarkProducerConsumer(BenchAllocator allocator, size_t nops, size_t npairs);
+/// 申请和释放256KB到4MB的大块内存
+BenchResult BenchmarkLargeAlloc(BenchAllocator allocator, size_t nops, size_t nworks);
+/// 输出一个场景的测试结果
+void PrintBenchResult(const char* name, BenchAllocator allocator, size_t nworks, const BenchResult& result);
 
 #endif // !_TEST_H_
@@ -1,18 +1,23 @@
 #ifndef __APOLLO_CENTRAL_CACHE_H__
 #define __APOLLO_CENTRAL_CACHE_H__
 
+#include "transfercache.h"
 #include "utilis.h"
 
 namespace apollo {
+struct MallocStats;
+
 /**
  * @brief 中心缓存对象
- * @details 线程共享，需要桶锁，内部结构与ThreadCache类似
+ * @details 线程共享，需要桶锁，内部结构与ThreadCache类似。
+ * 每个哈希桶前另有一个TransferCache，优先在其中整批交换对象。
+ * 开启APLNUMA选项后每个NUMA节点各有一个CentralCache，只从本节点的PageCache分片申请Span
  */
 class CentralCache {
 public:
-    static CentralCache* getInstance() {
-        static CentralCache cache;
-        return &cache;
+    static CentralCache* getInstance(size_t node = 0) {
+        static CentralCache caches[kMaxNumaNodes];
+        return &caches[node];
     }
 
     /**
@@ -22,9 +27,10 @@ public:
      * @param _end 传出参数，连续对象的末尾地址
      * @param _cnt 连续对象的个数
      * @param _size 单个对象的大小
+     * @param _origin 获取对象的ThreadCache的编号，从Span中取出对象时记录到对象所在的页上
      * @return 返回实际获取到的对象个数
      */
-    size_t fetchRangeObj(void*& start, void*& end, size_t cnt, size_t size);
+    size_t fetchRangeObj(void*& start, void*& end, size_t cnt, size_t size, uint16_t origin = 0);
 
     /**
      * @brief 将一定数量的自由链表对象归还给对应的Span
@@ -34,6 +40,23 @@ public:
      */
     void releaseList(void* start, size_t size);
 
+    /**
+     * @brief 将ThreadCache归还的一批对象放回CentralCache
+     * @details 优先整批放入TransferCache，其已满时再逐个归还给对应的Span
+     *
+     * @param _start 连续对象的起始地址
+     * @param _end 连续对象的末尾地址
+     * @param _cnt 连续对象的个数
+     * @param _size 单个对象的大小
+     */
+    void insertRange(void* start, void* end, size_t cnt, size_t size);
+
+    /**
+     * @brief 收集每个哈希桶的统计信息
+     * @details 分配给ThreadCache的字节数累加到inUseBytes_中，由调用者扣除缓存的部分
+     */
+    void collectStats(MallocStats& stats);
+
 private:
     /**
      * @brief 获取一个非空的Span对象
@@ -46,12 +69,14 @@ private:
     Span* getOneSpan(SpanList& list, size_t size, std::unique_lock<std::mutex>& bucket_lock);
 
 private:
-    CentralCache()                               = default;
+    CentralCache();
     CentralCache(const CentralCache&)            = delete;
     CentralCache& operator=(const CentralCache&) = delete;
 
 private:
-    SpanList spanlists_[kBucketSize];
+    size_t        node_; // 所属的NUMA节点
+    SpanList      spanlists_[kBucketSize];
+    TransferCache transfers_[kBucketSize];
 };
 } // namespace apollo
 
@@ -1,20 +1,49 @@
 #ifndef __APOLLO_CONCURRENT_ALLOC_H__
 #define __APOLLO_CONCURRENT_ALLOC_H__
 
+#include "centralcache.h"
+#include "cpucache.h"
+#include "heapprofiler.h"
+#include "numa.h"
 #include "pagecache.h"
 #include "threadcache.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 void* operator new(size_t size);
 void* operator new[](size_t size);
 void  operator delete(void* ptr) noexcept;
 void  operator delete[](void* ptr) noexcept;
+#ifdef __cpp_sized_deallocation
+void operator delete(void* ptr, size_t size) noexcept;
+void operator delete[](void* ptr, size_t size) noexcept;
+#endif
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t align);
+void* operator new[](size_t size, std::align_val_t align);
+void  operator delete(void* ptr, std::align_val_t align) noexcept;
+void  operator delete[](void* ptr, std::align_val_t align) noexcept;
+void  operator delete(void* ptr, size_t size, std::align_val_t align) noexcept;
+void  operator delete[](void* ptr, size_t size, std::align_val_t align) noexcept;
+#endif
 
 namespace apollo {
 
-static TLS ThreadCache* s_tlsthreadcache = nullptr;
-
 static void* concurrentAlloc(size_t size) {
+    if (size == 0) // 申请0字节时也要返回一个唯一的地址
+    {
+        size = 1;
+    }
+
+    // 未开启采样时计数器每16MB才会触发一次
+    if (HeapProfiler::shouldSample(size)) {
+        void* ptr = HeapProfiler::sampledAlloc(size);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+    }
+
     if (size > kMaxBytes) // 大于256KB的内存申请
     {
         // 计算出对齐后需要申请的页数
@@ -24,47 +53,231 @@ static void* concurrentAlloc(size_t size) {
         // 向PageCache申请npage页的span
         Span* span = nullptr;
         {
-            PageCache*                  cache = PageCache::getInstance();
+            PageCache* cache = PageCache::getInstance(PageCache::shardOf(alignsize, NumaHelper::currentNode()));
             std::lock_guard<std::mutex> lock(cache->mtx_);
-            span             = cache->newSpan(npage);
-            span->used_      = true;
-            span->blockSize_ = size;
+            span        = cache->newSpan(npage);
+            span->used_ = true;
+            cache->addLargeSpan(span);
         }
         assert(span);
 
         void* ptr = (void*)(span->pageId_ << kPageShift);
         return ptr;
     } else {
-        // 通过TLS，每个线程无锁的获取自己专属的ThreadCache对象
-        if (s_tlsthreadcache == nullptr) {
-            static std::mutex              mtx;
-            static ObjectPool<ThreadCache> tcpool;
-            {
-                std::lock_guard<std::mutex> lock(mtx);
-                s_tlsthreadcache = tcpool.alloc();
-            }
-        }
+#ifdef APLPERCPU
+        return CpuCache::getInstance()->allocate(size);
+#else
+        return ThreadCache::getInstance()->allocate(size);
+#endif
+    }
+}
 
-        return s_tlsthreadcache->allocate(size);
+/**
+ * @brief 将小块内存释放到当前线程或CPU的缓存中
+ * @details 开启APLNUMA选项后，属于其它NUMA节点的对象直接归还给其所属节点的CentralCache，
+ * 避免被本节点的线程复用而产生跨节点的内存访问。由其它线程申请的对象同样先进入本线程的缓存，
+ * 自由链表过长时再整批送回其来源线程，释放时无需判断对象的归属
+ *
+ * @param _span 对象所属的Span，未开启APLNUMA选项时可以为空
+ */
+static inline void freeToCache(void* ptr, size_t size, const Span* span) {
+#ifdef APLPERCPU
+#ifdef APLNUMA
+    size_t node = PageCache::nodeOf(span);
+    if (!CpuCache::getInstance()->deallocate(ptr, size, node)) {
+        nextObj(ptr) = nullptr;
+        CentralCache::getInstance(node)->releaseList(ptr, size);
     }
+#else
+    (void)span;
+    CpuCache::getInstance()->deallocate(ptr, size);
+#endif
+#else
+    // 释放内存的线程可能从未申请过内存 此时为其创建ThreadCache
+    // 线程退出并回收了ThreadCache之后仍可能释放对象 此时直接归还给CentralCache
+    ThreadCache* cache = ThreadCache::getInstanceForFree();
+#ifdef APLNUMA
+    size_t node = PageCache::nodeOf(span);
+    if (cache == nullptr || node != cache->node()) {
+#else
+    (void)span;
+    size_t node = 0;
+    if (cache == nullptr) {
+#endif
+        nextObj(ptr) = nullptr;
+        CentralCache::getInstance(node)->releaseList(ptr, size);
+        return;
+    }
+    cache->deallocate(ptr, size);
+#endif
 }
 
+/**
+ * @brief 释放内存
+ * @details 小块内存的大小由页映射中记录的哈希桶下标确定，只有需要判断对象所属的NUMA节点时才读取Span
+ */
 static void concurrentFree(void* ptr) {
-    if (ptr != nullptr) {
-        Span*  span = PageCache::getInstance()->mapToSpan(ptr);
-        size_t size = span->blockSize_;
+    if (ptr == nullptr) {
+        return;
+    }
 
-        if (size > kMaxBytes) // 大于256KB的内存释放
-        {
-            PageCache* cache = PageCache::getInstance();
+    PageCache* pages = PageCache::getInstance();
+    size_t     cl    = pages->sizeClassOf(ptr);
+    if (cl != 0) {
+#ifdef APLNUMA
+        freeToCache(ptr, AlignHelper::classSize(cl - 1), pages->mapToSpan(ptr));
+#else
+        freeToCache(ptr, AlignHelper::classSize(cl - 1), nullptr);
+#endif
+        return;
+    }
 
-            std::lock_guard<std::mutex> lock(cache->mtx_);
+    // 按页申请或者被采样的内存
+    Span* span = pages->mapToSpan(ptr);
+    if (span->sampled_) {
+        HeapProfiler::sampledFree(ptr, span);
+    } else {
+        PageCache* cache = PageCache::ownerOf(span);
+
+        std::lock_guard<std::mutex> lock(cache->mtx_);
+
+        cache->removeLargeSpan(span);
+        cache->revertSpanToPageCache(span);
+    }
+}
+
+/**
+ * @brief 释放已知大小的内存
+ * @details size须与申请时的大小一致，此时无需读取Span即可确定对象所属的哈希桶，
+ * 只有需要判断对象所属的NUMA节点或者存在被采样的对象时才查找页映射
+ */
+static void concurrentFree(void* ptr, size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
 
-            cache->revertSpanToPageCache(span);
-        } else {
-            assert(s_tlsthreadcache);
-            s_tlsthreadcache->deallocate(ptr, size);
+    if (size > kMaxBytes) // 大于256KB的内存释放需要通过Span找到对应的页
+    {
+        concurrentFree(ptr);
+        return;
+    }
+
+    if (size == 0) // 与申请时保持一致
+    {
+        size = 1;
+    }
+
+#ifdef APLNUMA
+    // 需要通过Span确定对象所属的节点
+    Span* span = PageCache::getInstance()->mapToSpan(ptr);
+    if (span->sampled_) {
+        HeapProfiler::sampledFree(ptr, span);
+        return;
+    }
+    freeToCache(ptr, size, span);
+#else
+    // 存在被采样的对象时 被采样的对象所在的页没有记录哈希桶
+    if (HeapProfiler::liveSamples() > 0 && PageCache::getInstance()->sizeClassOf(ptr) == 0) {
+        concurrentFree(ptr);
+        return;
+    }
+    freeToCache(ptr, size, nullptr);
+#endif
+}
+
+/**
+ * @brief 获取内存块实际可用的字节数
+ * @details 小块内存为其所属哈希桶中对象的大小，按页申请以及被采样的内存为其所占页的总大小
+ */
+static size_t concurrentUsableSize(void* ptr) {
+    if (ptr == nullptr) {
+        return 0;
+    }
+    size_t cl = PageCache::getInstance()->sizeClassOf(ptr);
+    if (cl != 0) {
+        return AlignHelper::classSize(cl - 1);
+    }
+    return PageCache::getInstance()->mapToSpan(ptr)->cnt_ << kPageShift;
+}
+
+/**
+ * @brief 调整内存块的大小
+ * @details 新的大小仍属于同一个哈希桶，或者仍按页申请且不超过已占用的页、不少于其一半时原地调整，
+ * 否则申请新的内存并复制原有的内容。_size为0时释放_ptr并返回空指针
+ */
+static inline void* concurrentRealloc(void* ptr, size_t size) {
+    if (ptr == nullptr) {
+        return concurrentAlloc(size);
+    }
+    if (size == 0) {
+        concurrentFree(ptr);
+        return nullptr;
+    }
+
+    size_t usable = concurrentUsableSize(ptr);
+    if (usable <= kMaxBytes) {
+        if (size <= kMaxBytes && AlignHelper::roundUp(size) == usable) {
+            return ptr;
         }
+    } else if (size > kMaxBytes && size <= usable && size >= usable / 2) {
+        return ptr;
+    }
+
+    void* newptr = concurrentAlloc(size);
+    memcpy(newptr, ptr, std::min(size, usable));
+    concurrentFree(ptr);
+    return newptr;
+}
+
+/**
+ * @brief 获取按照align对齐后实际需要申请的字节数
+ * @details 不超过一页的对齐数，将大小向上取整为对齐数的整数倍即可，
+ * 因为对齐后的内存块大小也是对齐数的整数倍，且Span的起始地址按页对齐
+ */
+static inline size_t alignedSize(size_t size, size_t align) {
+    if (size == 0) {
+        size = 1;
+    }
+    return (size + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief 申请按照align字节对齐的内存
+ *
+ * @param _size 申请的字节数
+ * @param _align 对齐数，须为2的整数次幂
+ */
+static inline void* concurrentAllocAligned(size_t size, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (align <= (1 << kPageShift)) {
+        return concurrentAlloc(alignedSize(size, align));
+    }
+
+    // 超过一页的对齐数直接按页申请 多申请的页会归还给PageCache
+    size_t npage      = (alignedSize(size, 1 << kPageShift)) >> kPageShift;
+    size_t alignpages = align >> kPageShift;
+
+    Span* span = nullptr;
+    {
+        PageCache* cache = PageCache::getInstance(PageCache::shardOf(npage << kPageShift, NumaHelper::currentNode()));
+        std::lock_guard<std::mutex> lock(cache->mtx_);
+        span = cache->newAlignedSpan(npage, alignpages);
+        cache->addLargeSpan(span);
+    }
+    assert(span);
+
+    return (void*)(span->pageId_ << kPageShift);
+}
+
+/**
+ * @brief 释放已知大小且按照align字节对齐的内存
+ */
+static inline void concurrentFreeAligned(void* ptr, size_t size, size_t align) {
+    if (align <= (1 << kPageShift)) {
+        concurrentFree(ptr, alignedSize(size, align));
+    } else {
+        concurrentFree(ptr);
     }
 }
 } // namespace apollo
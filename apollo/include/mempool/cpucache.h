@@ -0,0 +1,75 @@
+#ifndef __APOLLO_CPU_CACHE_H__
+#define __APOLLO_CPU_CACHE_H__
+
+#include "threadcache.h"
+
+namespace apollo {
+/**
+ * @brief 每个CPU一份的前端缓存
+ * @details 开启APLPERCPU选项后代替每个线程独享的ThreadCache，缓存的内存随CPU核数
+ * 而不是线程数增长。当前CPU编号优先从glibc注册的rseq区域读取，否则使用sched_getcpu。
+ * 线程在读取CPU编号后仍可能被迁移，因此每个槽位都有一个自旋锁，同一CPU上的线程
+ * 几乎不会竞争该锁
+ */
+class CpuCache {
+public:
+    static CpuCache* getInstance() {
+        static CpuCache cache;
+        return &cache;
+    }
+
+    /**
+     * @brief 从当前CPU的缓存中申请内存对象
+     */
+    void* allocate(size_t size);
+
+    /**
+     * @brief 将内存对象释放到当前CPU的缓存中
+     *
+     * @param _ptr 要释放的内存对象
+     * @param _size 对象的大小
+     */
+    void deallocate(void* ptr, size_t size);
+
+    /**
+     * @brief 将属于_node节点的内存对象释放到当前CPU的缓存中
+     * @details 槽位只选取一次，并在持有其锁时比较节点，线程在两者之间被迁移到其它节点的CPU上时
+     * 也不会将对象放入其它节点的缓存
+     *
+     * @param _ptr 要释放的内存对象
+     * @param _size 对象的大小
+     * @param _node 对象所属的NUMA节点
+     * @return 当前CPU不属于_node节点时返回false，对象未被释放
+     */
+    bool deallocate(void* ptr, size_t size, size_t node);
+
+    /**
+     * @brief 收集所有CPU缓存的统计信息
+     */
+    void collectStats(MallocStats& stats);
+
+private:
+    CpuCache();
+    CpuCache(const CpuCache&)            = delete;
+    CpuCache& operator=(const CpuCache&) = delete;
+
+    /**
+     * @brief 获取当前线程所在CPU对应的槽位
+     */
+    size_t currentSlot() const;
+
+private:
+    /**
+     * @brief 单个CPU的缓存，按缓存行对齐避免伪共享
+     */
+    struct alignas(64) Slot {
+        SpinLock    lock_;
+        ThreadCache cache_;
+    };
+
+    Slot*  slots_;  // 槽位数组，直接向系统申请
+    size_t nslots_; // 槽位数目，即CPU的数目
+};
+} // namespace apollo
+
+#endif // !__APOLLO_CPU_CACHE_H__
@@ -0,0 +1,83 @@
+#ifndef __APOLLO_HEAP_PROFILER_H__
+#define __APOLLO_HEAP_PROFILER_H__
+
+#include "utilis.h"
+
+namespace apollo {
+/**
+ * @brief 采样堆分析器
+ * @details 平均每申请sampleRate字节的内存采样一次，记录申请时的调用栈。两次采样之间申请的字节数服从指数分布，
+ * 因此每个字节被采样的概率相同，大对象被采样的概率更高。被采样的对象单独占用一个Span并在Span上打上标记，
+ * 释放时据此识别并删除其采样记录。未开启采样时，申请内存只多一次线程局部计数器的减法，
+ * 该计数器每16MB才会触发一次慢路径检查是否开启了采样。
+ * 仍存活的采样对象可以按照gperftools的堆分析格式输出，由pprof解析
+ */
+class HeapProfiler {
+public:
+    /**
+     * @brief 设置采样的平均间隔
+     *
+     * @param _rate 平均每申请多少字节采样一次，为0时关闭采样
+     */
+    static void setSampleRate(size_t rate);
+
+    /**
+     * @brief 获取采样的平均间隔，为0表示未开启采样
+     */
+    static size_t sampleRate();
+
+    /**
+     * @brief 按照配置文件中的heapSampleRate和heapProfile开启采样
+     * @details 开启TCMALLOC时在加载内存池时自动调用，开启采样后收到SIGUSR2信号输出一份堆分析文件
+     */
+    static void start();
+
+    /**
+     * @brief 判断本次申请是否可能需要采样
+     * @details 为true时须调用sampledAlloc
+     */
+    static bool shouldSample(size_t size) {
+        tlsBytesUntilSample_ -= static_cast<int64_t>(size);
+        return tlsBytesUntilSample_ < 0;
+    }
+
+    /**
+     * @brief 申请一个被采样的对象，并记录当前的调用栈
+     * @return 未开启采样时只重置计数器并返回空指针，调用者按正常流程申请
+     */
+    static void* sampledAlloc(size_t size);
+
+    /**
+     * @brief 释放一个被采样的对象
+     *
+     * @param _ptr 要释放的对象
+     * @param _span 对象所属的Span，其sampled_为true
+     */
+    static void sampledFree(void* ptr, Span* span);
+
+    /**
+     * @brief 仍存活的采样对象个数
+     * @details 已知大小的释放不查找Span时，以此判断是否需要检查对象是否被采样
+     */
+    static size_t liveSamples() { return liveSamples_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 将仍存活的采样对象按照gperftools的堆分析格式写入文件
+     * @return 文件打开失败时返回false
+     */
+    static bool dump(const char* path);
+
+    /**
+     * @brief 收到_signo信号时输出一份堆分析文件
+     * @details 信号处理函数只唤醒独立的输出线程，由该线程写入文件，文件名为_prefix.<序号>.heap。
+     * 只有第一次调用生效
+     */
+    static void dumpOnSignal(int signo, const char* prefix);
+
+private:
+    static TLS int64_t         tlsBytesUntilSample_; // 距离下一次采样还需申请的字节数
+    static std::atomic<size_t> liveSamples_;         // 仍存活的采样对象个数
+};
+} // namespace apollo
+
+#endif // !__APOLLO_HEAP_PROFILER_H__
@@ -0,0 +1,68 @@
+#ifndef __APOLLO_MALLOC_STATS_H__
+#define __APOLLO_MALLOC_STATS_H__
+
+#include "utilis.h"
+#include <string>
+
+namespace apollo {
+/**
+ * @brief 单个哈希桶的统计信息
+ */
+struct SizeClassStats {
+    size_t size_;               // 对象的大小
+    size_t inUseBytes_;         // 正在被使用的字节数
+    size_t threadCacheBytes_;   // 缓存在ThreadCache中的字节数
+    size_t transferCacheBytes_; // 缓存在TransferCache中的字节数
+    size_t centralCacheBytes_;  // CentralCache的Span中空闲的字节数
+    size_t remoteFreeBytes_;    // 在远程释放队列中尚未被来源线程取回的字节数
+    size_t spans_;              // CentralCache中的Span数目
+};
+
+/**
+ * @brief PageCache中单个哈希桶的统计信息
+ */
+struct PageBucketStats {
+    size_t spans_;         // 空闲的Span数目
+    size_t bytes_;         // 空闲的字节数
+    size_t releasedBytes_; // 其中物理内存已归还给操作系统的字节数
+};
+
+/**
+ * @brief 内存池的统计信息
+ * @details 只包含定长的数组，收集过程中不会申请内存，可以直接定义在栈上。
+ * 其他线程的ThreadCache在收集时未加锁，因此ThreadCache相关的数据是近似值
+ */
+struct MallocStats {
+    SizeClassStats  classes_[kBucketSize];         // 每个哈希桶的统计信息
+    PageBucketStats pageBuckets_[kPageBucketSize]; // PageCache每个哈希桶的统计信息，下标为页数
+
+    size_t inUseBytes_;         // 正在被使用的字节数，包括大块内存
+    size_t threadCacheBytes_;   // 缓存在ThreadCache中的字节数
+    size_t transferCacheBytes_; // 缓存在TransferCache中的字节数
+    size_t centralCacheBytes_;  // CentralCache的Span中空闲的字节数
+    size_t remoteFreeBytes_;    // 在远程释放队列中的字节数
+    size_t pageCacheBytes_;     // PageCache中空闲的字节数
+    size_t releasedBytes_;      // 空闲且物理内存已归还给操作系统的字节数
+    size_t largeBytes_;         // 直接按页申请的大块内存的字节数
+    size_t largeSpans_;         // 直接按页申请的大块内存的数目
+    size_t systemBytes_;        // 从操作系统获取的字节数
+    size_t hugePageBytes_;      // 建议内核使用透明大页的字节数
+    size_t anonHugePageBytes_;  // 进程中实际由透明大页支撑的字节数
+    size_t threadCaches_;       // ThreadCache的数目
+    size_t threadCacheLimit_;   // 所有ThreadCache缓存的总字节数上限
+    double fragmentation_;      // 碎片率，即驻留内存中未被使用的比例
+
+    /**
+     * @brief 收集当前内存池的统计信息
+     */
+    static void collect(MallocStats& stats);
+
+    /**
+     * @brief 将统计信息格式化为便于阅读的文本
+     * @details 只输出非空的哈希桶
+     */
+    std::string toString() const;
+};
+} // namespace apollo
+
+#endif // !__APOLLO_MALLOC_STATS_H__
@@ -0,0 +1,44 @@
+#ifndef __APOLLO_NUMA_H__
+#define __APOLLO_NUMA_H__
+
+#include "utilis.h"
+
+namespace apollo {
+/**
+ * @brief NUMA节点相关的辅助函数
+ * @details 只在开启APLNUMA选项时生效，否则所有内存和线程都视为位于0号节点。
+ * 直接读取sysfs并通过系统调用实现，不依赖libnuma，且过程中不会申请内存
+ */
+class NumaHelper {
+public:
+#ifdef APLNUMA
+    /**
+     * @brief 获取NUMA节点的数目，不超过kMaxNumaNodes
+     */
+    static size_t nodes();
+
+    /**
+     * @brief 获取当前线程所在的NUMA节点
+     */
+    static size_t currentNode();
+
+    /**
+     * @brief 获取_cpu所属的NUMA节点
+     */
+    static size_t nodeOfCpu(size_t cpu);
+
+    /**
+     * @brief 使[_ptr, _ptr+_bytes)中的页优先从_node节点分配物理内存
+     * @details 需要在这些页第一次被访问之前调用
+     */
+    static void bind(void* ptr, size_t bytes, size_t node);
+#else
+    static size_t nodes() { return 1; }
+    static size_t currentNode() { return 0; }
+    static size_t nodeOfCpu(size_t) { return 0; }
+    static void   bind(void*, size_t, size_t) { }
+#endif
+};
+} // namespace apollo
+
+#endif // !__APOLLO_NUMA_H__
@@ -1,21 +1,50 @@
 #ifndef __APOLLO_PAGE_CACHE_H__
 #define __APOLLO_PAGE_CACHE_H__
 
-#include "utilis.h"
+#include "pageheap.h"
 #include "radixtree.h"
+#include "utilis.h"
+#include <cassert>
 #include <mutex>
 // #include <unordered_map>
 
 namespace apollo {
+struct MallocStats;
+
 /**
  * @brief 页缓存对象
- * @details 线程共享，需要对象锁
+ * @details 线程共享，需要对象锁。
+ * PageCache分为kPageShards个分片，每个分片拥有独立的锁、空闲Span链表和页堆，
+ * 不同大小的内存申请落在不同的分片上，互不阻塞。页号到Span的映射由所有分片共享，
+ * 每个Span记录其所属的分片，相邻但属于不同分片的Span不会合并。
+ * 开启APLNUMA选项后每个NUMA节点各有kPageShards个分片，其页堆只从该节点分配物理内存
  */
 class PageCache {
 public:
-    static PageCache* getInstance() {
-        static PageCache cache;
-        return &cache;
+    static PageCache* getInstance(size_t shard = 0) {
+        static PageCache caches[kTotalPageShards];
+        return &caches[shard];
+    }
+
+    /**
+     * @brief 获取_span所属的分片
+     */
+    static PageCache* ownerOf(const Span* span) { return getInstance(span->shard_.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief 获取_span所属的NUMA节点
+     */
+    static size_t nodeOf(const Span* span) { return span->shard_.load(std::memory_order_relaxed) / kPageShards; }
+
+    /**
+     * @brief 获取_node节点上申请_bytes字节时所使用的分片
+     * @details 小块内存按哈希桶下标分散到各个分片，大块内存按页数分散
+     */
+    static size_t shardOf(size_t bytes, size_t node = 0) {
+        if (bytes > kMaxBytes) {
+            return node * kPageShards + (bytes >> kPageShift) % kPageShards;
+        }
+        return node * kPageShards + AlignHelper::index(bytes) % kPageShards;
     }
 
     /**
@@ -23,29 +52,149 @@ public:
      */
     Span* newSpan(size_t npage);
 
+    /**
+     * @brief 获取一个_npage页且起始页号按_alignpages页对齐的Span对象
+     * @details 多申请_alignpages - 1页，再将对齐后首尾多余的页归还给PageCache；多申请后超过128页时
+     * 由页堆单独映射一块对齐的内存，不做切分。返回的Span已被标记为正在使用
+     */
+    Span* newAlignedSpan(size_t npage, size_t alignpages);
+
     /**
      * @brief 获取对象到Span的映射
+     * @details 无需持有mtx_，可以与建立映射的操作并发执行，任意分片均可查询
      */
-    Span* mapToSpan(void* obj);
+    Span* mapToSpan(void* obj) const {
+        Span* ret = (Span*)hash_.get((page_t)obj >> kPageShift);
+        assert(ret);
+        return ret;
+    }
+
+    /**
+     * @brief 获取_obj所在页被切分成的小块内存所属的哈希桶下标加1
+     * @details 只读取页号对应的一个字节而无需访问Span，按页申请、被采样以及空闲的页均为0
+     */
+    size_t sizeClassOf(void* obj) const { return hash_.getSizeClass((page_t)obj >> kPageShift); }
+
+    /**
+     * @brief 为_span的每一页记录其小块内存所属的哈希桶
+     *
+     * @param _cl 哈希桶下标加1，为0时清除记录
+     */
+    void setSizeClass(const Span* span, size_t cl) {
+        static_assert(kBucketSize < 256, "size class must fit in one byte");
+        for (page_t i = 0; i < span->cnt_; i++) {
+            hash_.setSizeClass(span->pageId_ + i, static_cast<uint8_t>(cl));
+        }
+    }
+
+    /**
+     * @brief 获取最近从_obj所在页取走对象的ThreadCache的编号
+     * @details 只读取页号对应的两个字节，未记录时为0。同一页的对象可能分给了不同的线程，结果只是一个提示
+     */
+    size_t originOf(void* obj) const { return hash_.getOrigin((page_t)obj >> kPageShift); }
+
+    /**
+     * @brief 记录_obj所在页的对象由编号为_id的ThreadCache取走
+     */
+    void setOrigin(void* obj, uint16_t id) { hash_.setOrigin((page_t)obj >> kPageShift, id); }
 
     /**
      * @brief 释放空闲的Span到PageCache 并合并相邻的Span
      */
     void revertSpanToPageCache(Span* span);
 
+    /**
+     * @brief 将空闲Span的物理内存归还给操作系统
+     * @details 优先归还页数多的Span，调用者无需持有mtx_。
+     * 调用madvise期间会释放mtx_，不会阻塞其它线程的内存申请。
+     * 开启APLHUGEPAGE选项后只以整个大页为单位归还
+     * @param bytes 期望归还的字节数
+     * @param idleMs 只归还空闲时间不少于idleMs毫秒的Span
+     * @return 返回实际归还的字节数
+     */
+    size_t releaseToSystem(size_t bytes, uint64_t idleMs = 0);
+
+    /**
+     * @brief 记录直接按页申请的大块内存，调用者需持有mtx_
+     */
+    void addLargeSpan(const Span* span) {
+        largeSpans_++;
+        largeBytes_ += span->cnt_ << kPageShift;
+    }
+
+    /**
+     * @brief 大块内存释放时更新记录，调用者需持有mtx_
+     */
+    void removeLargeSpan(const Span* span) {
+        largeSpans_--;
+        largeBytes_ -= span->cnt_ << kPageShift;
+    }
+
+    /**
+     * @brief 将本分片中每个哈希桶空闲Span的统计信息以及大块内存的统计信息累加到stats中
+     */
+    void collectStats(MallocStats& stats);
+
 private:
-    PageCache()                            = default;
+    PageCache();
     PageCache(const PageCache&)            = delete;
     PageCache& operator=(const PageCache&) = delete;
 
+#ifdef APLHUGEPAGE
+    /**
+     * @brief 收集_span所在大页中的所有Span
+     * @param group 用于存放Span的数组，至少包含kHugePagePages个元素
+     * @return 大页中所有页都属于空闲足够久的Span时返回Span的数目，否则返回0
+     */
+    size_t collectHugePage(const Span* span, uint64_t now, uint64_t idleMs, Span** group);
+
+    /**
+     * @brief 在不少于_npage页的空闲Span中查找一个所在大页已有页被使用的Span
+     * @details 只检查与Span相邻的页，总共最多检查kPackScanSpans个Span，找不到时返回空指针
+     */
+    Span* findPackedSpan(size_t npage);
+
+    /**
+     * @brief 空闲的_span所在的大页中与其相邻的页是否正在被使用
+     * @details 属于其它分片的相邻Span同样视为正在使用，不读取其状态
+     */
+    bool hugePageInUse(const Span* span) const;
+
+    /// 查找紧凑放置的Span时最多检查的Span个数
+    static const size_t kPackScanSpans = 16;
+#endif
+
+    /**
+     * @brief 将空闲的_span与前后相邻的空闲Span合并，挂入对应的链表并建立首尾页的映射
+     * @details _span须已被标记为空闲且不在链表中。物理内存是否已归还的状态不同的Span不会合并，
+     * 因此每个Span的released_都是准确的
+     *
+     * @return 合并后的Span
+     */
+    Span* coalesce(Span* span);
+
+    /**
+     * @brief 从对象池中申请一个属于本分片的Span对象
+     */
+    Span* allocSpan() {
+        Span* span = span_pool_.alloc();
+        // Span对象只会在同一个分片的对象池中复用 其它分片通过过期的映射读到的始终是本分片的编号
+        span->shard_.store(shard_, std::memory_order_relaxed);
+        return span;
+    }
+
 public:
     std::mutex mtx_;
 
 private:
     SpanList spanlists_[kPageBucketSize];
     // std::unordered_map<page_t, Span*> hash_;
-    PageMap          hash_;
+    uint8_t          shard_; // 分片的编号
+    PageMap&         hash_;  // 所有分片共享的页号到Span的映射
     ObjectPool<Span> span_pool_;
+    PageHeap         heap_;           // 向操作系统申请内存的页堆
+    size_t           largeSpans_ = 0; // 直接按页申请的大块内存的数目
+    size_t           largeBytes_ = 0; // 直接按页申请的大块内存的字节数
 };
 } // namespace apollo
 
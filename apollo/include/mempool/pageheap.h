@@ -0,0 +1,87 @@
+#ifndef __APOLLO_PAGE_HEAP_H__
+#define __APOLLO_PAGE_HEAP_H__
+
+#include "utilis.h"
+
+namespace apollo {
+/// 透明大页的大小，即2MB
+static const size_t kHugePageShift = 21;
+/// 一个透明大页包含的页数
+static const size_t kHugePagePages = 1 << (kHugePageShift - kPageShift);
+
+/**
+ * @brief 页堆，PageCache向操作系统申请内存的后端
+ * @details 通过mmap一次预留大块的虚拟地址空间，按需提交给PageCache使用；
+ * 空闲的页可以通过madvise归还物理内存，同时保留虚拟地址以便后续复用。
+ * 超过PageCache所能管理的最大页数的内存直接单独映射，释放时直接解除映射。
+ * 开启APLHUGEPAGE选项后，预留的区域按2MB对齐并通过madvise(MADV_HUGEPAGE)
+ * 建议内核使用透明大页，同时以大页为单位提交，避免一个大页被拆分到不同的映射中。
+ * 非线程安全，由PageCache的锁保护
+ */
+class PageHeap {
+public:
+    /**
+     * @param _node 开启APLNUMA选项时，申请到的内存优先从_node节点分配物理内存
+     */
+    explicit PageHeap(size_t node = 0)
+        : node_(node) { }
+    PageHeap(const PageHeap&)            = delete;
+    PageHeap& operator=(const PageHeap&) = delete;
+
+    /**
+     * @brief 申请npage页的内存
+     */
+    void* allocate(size_t npage);
+
+    /**
+     * @brief 单独映射npage页、起始地址按alignpages页对齐的内存
+     * @details 映射的起始地址即返回的地址，可以通过deallocate整体释放
+     */
+    void* allocateAligned(size_t npage, size_t alignpages);
+
+    /**
+     * @brief 将单独映射的npage页内存彻底归还给操作系统
+     */
+    void deallocate(void* ptr, size_t npage);
+
+    /**
+     * @brief 将npage页的物理内存归还给操作系统，保留其虚拟地址
+     * @details 被归还的页再次访问时由内核重新分配并清零
+     */
+    void release(void* ptr, size_t npage);
+
+    /**
+     * @brief 返回已经向操作系统提交的字节数
+     */
+    size_t systemBytes() const { return systemBytes_; }
+
+    /**
+     * @brief 返回已建议内核使用透明大页的字节数
+     */
+    size_t hugePageBytes() const { return hugePageBytes_; }
+
+private:
+    /**
+     * @brief 预留一块新的虚拟地址区域
+     */
+    void reserveRegion();
+
+    /**
+     * @brief 提交预留区域中的一段地址空间
+     */
+    void commit(void* ptr, size_t bytes);
+
+private:
+    /// 单个预留区域的页数，即1GB
+    static const size_t kRegionPages = 1 << (30 - kPageShift);
+
+    size_t node_;                    // 所属的NUMA节点
+    char*  region_        = nullptr; // 当前预留区域中尚未分配的起始地址
+    char*  committed_     = nullptr; // 当前预留区域中已提交部分的末尾地址
+    size_t regionRemain_  = 0;       // 当前预留区域中剩余的页数
+    size_t systemBytes_   = 0;       // 已提交的字节数
+    size_t hugePageBytes_ = 0;       // 已建议使用透明大页的字节数
+};
+} // namespace apollo
+
+#endif // !__APOLLO_PAGE_HEAP_H__
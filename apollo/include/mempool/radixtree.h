@@ -2,8 +2,10 @@
 #define __APOLLO_RADIX_TREE_H__
 
 #include "utilis.h"
+#include <atomic>
 #include <cassert>
 #include <cstring>
+#include <mutex>
 
 namespace apollo {
 template <int BITS>
@@ -21,7 +23,9 @@ private:
         Node* ptrs_[kInteriorLength];
     };
     struct Leaf {
-        void* values_[kLeafLength];
+        void*    values_[kLeafLength];
+        uint8_t  sizeClasses_[kLeafLength];
+        uint16_t origins_[kLeafLength];
     };
 
     Node* newNode() {
@@ -33,7 +37,8 @@ private:
         return res;
     }
 
-    Node* root_;
+    Node*      root_;
+    std::mutex mtx_; // 保护空间的开辟
 
 public:
     explicit RadixTree() {
@@ -62,7 +67,46 @@ public:
         reinterpret_cast<Leaf*>(root_->ptrs_[idx_first]->ptrs_[idx_second])->values_[idx_third] = ptr;
     }
 
-private:
+    size_t getSizeClass(idx_t idx) const {
+        const idx_t idx_first  = idx >> (kLeafBits + kInteriorBits);         // 第一层对应的下标
+        const idx_t idx_second = (idx >> kLeafBits) & (kInteriorLength - 1); // 第二层对应的下标
+        const idx_t idx_third  = idx & (kLeafLength - 1);                    // 第三层对应的下标
+        if ((idx >> BITS) > 0 || root_->ptrs_[idx_first] == nullptr
+            || root_->ptrs_[idx_first]->ptrs_[idx_second] == nullptr) {
+            return 0;
+        }
+        return reinterpret_cast<Leaf*>(root_->ptrs_[idx_first]->ptrs_[idx_second])->sizeClasses_[idx_third];
+    }
+
+    void setSizeClass(idx_t idx, uint8_t cl) {
+        assert(idx >> BITS == 0);
+        const idx_t idx_first  = idx >> (kLeafBits + kInteriorBits);         // 第一层对应的下标
+        const idx_t idx_second = (idx >> kLeafBits) & (kInteriorLength - 1); // 第二层对应的下标
+        const idx_t idx_third  = idx & (kLeafLength - 1);                    // 第三层对应的下标
+        ensure(idx, 1);
+        reinterpret_cast<Leaf*>(root_->ptrs_[idx_first]->ptrs_[idx_second])->sizeClasses_[idx_third] = cl;
+    }
+
+    size_t getOrigin(idx_t idx) const {
+        const idx_t idx_first  = idx >> (kLeafBits + kInteriorBits);         // 第一层对应的下标
+        const idx_t idx_second = (idx >> kLeafBits) & (kInteriorLength - 1); // 第二层对应的下标
+        const idx_t idx_third  = idx & (kLeafLength - 1);                    // 第三层对应的下标
+        if ((idx >> BITS) > 0 || root_->ptrs_[idx_first] == nullptr
+            || root_->ptrs_[idx_first]->ptrs_[idx_second] == nullptr) {
+            return 0;
+        }
+        return reinterpret_cast<Leaf*>(root_->ptrs_[idx_first]->ptrs_[idx_second])->origins_[idx_third];
+    }
+
+    void setOrigin(idx_t idx, uint16_t id) {
+        assert(idx >> BITS == 0);
+        const idx_t idx_first  = idx >> (kLeafBits + kInteriorBits);         // 第一层对应的下标
+        const idx_t idx_second = (idx >> kLeafBits) & (kInteriorLength - 1); // 第二层对应的下标
+        const idx_t idx_third  = idx & (kLeafLength - 1);                    // 第三层对应的下标
+        ensure(idx, 1);
+        reinterpret_cast<Leaf*>(root_->ptrs_[idx_first]->ptrs_[idx_second])->origins_[idx_third] = id;
+    }
+
     /**
      * @brief 确保[_start, _start+_n-1]页号的空间是开辟好的
      */
@@ -73,32 +117,173 @@ private:
             // 下标值超出范围
             if (idx_first >= kInteriorLength || idx_second >= kInteriorLength)
                 return false;
-            if (root_->ptrs_[idx_first] == nullptr) // 第一层idx_first下标指向的空间未开辟
-            {
-                // 开辟对应空间
-                Node* n = newNode();
-                if (n == nullptr)
-                    return false;
-                root_->ptrs_[idx_first] = n;
-            }
-            if (root_->ptrs_[idx_first]->ptrs_[idx_second] == nullptr) // 第二层idx_second下标指向的空间未开辟
-            {
-                // 开辟对应空间
-                static ObjectPool<Leaf> leaf_pool;
-                Leaf*                   leaf = leaf_pool.alloc();
-                if (leaf == nullptr)
+            if (root_->ptrs_[idx_first] == nullptr || root_->ptrs_[idx_first]->ptrs_[idx_second] == nullptr) {
+                // 各个PageCache分片可能并发地开辟空间 加锁后再次检查
+                std::lock_guard<std::mutex> lock(mtx_);
+                if (!allocate(idx_first, idx_second))
                     return false;
-                memset(leaf, 0, sizeof(*leaf));
-                root_->ptrs_[idx_first]->ptrs_[idx_second] = reinterpret_cast<Node*>(leaf);
             }
             key = ((key >> kLeafBits) + 1) << kLeafBits; // 继续后续检查
         }
         return true;
     }
+
+private:
+    /**
+     * @brief 开辟第一层idx_first下标和第二层idx_second下标指向的空间，调用者需持有mtx_
+     */
+    bool allocate(idx_t idx_first, idx_t idx_second) {
+        if (root_->ptrs_[idx_first] == nullptr) // 第一层idx_first下标指向的空间未开辟
+        {
+            // 开辟对应空间
+            Node* n = newNode();
+            if (n == nullptr)
+                return false;
+            root_->ptrs_[idx_first] = n;
+        }
+        if (root_->ptrs_[idx_first]->ptrs_[idx_second] == nullptr) // 第二层idx_second下标指向的空间未开辟
+        {
+            // 开辟对应空间
+            static ObjectPool<Leaf> leaf_pool;
+            Leaf*                   leaf = leaf_pool.alloc();
+            if (leaf == nullptr)
+                return false;
+            memset(leaf, 0, sizeof(*leaf));
+            root_->ptrs_[idx_first]->ptrs_[idx_second] = reinterpret_cast<Node*>(leaf);
+        }
+        return true;
+    }
 };
 
-#ifdef _WIN64
-using PageMap = RadixTree<64 - kPageShift>;
+/**
+ * @brief 两层的基数树，用于用户态地址只有48位的平台
+ * @details 第一层为定长的数组，随对象一起静态分配，只有被访问到的部分才会占用物理内存；
+ * 第二层的叶子节点直接向系统申请，每个叶子节点覆盖1GB的地址空间。
+ * 叶子节点的指针和映射的值均以release语义发布，get()无需加锁即可与set()并发执行；
+ * 开辟叶子节点时使用CAS，不同的PageCache分片可以并发地为各自的页号调用set()。
+ * 叶子节点中还为每一页记录一个字节的哈希桶下标，一个缓存行即可覆盖64页，释放小块内存时无需访问Span；
+ * 以及最近从该页取走对象的ThreadCache的编号，用于将其它线程释放的对象送回
+ */
+template <int BITS>
+class TwoLevelRadixTree {
+public:
+    using idx_t = uintptr_t;
+
+private:
+    static const int kLeafBits   = 30 - kPageShift;    // 第二层对应页号的比特位个数
+    static const int kLeafLength = 1 << kLeafBits;     // 第二层存储元素的个数
+    static const int kRootBits   = BITS - kLeafBits;   // 第一层对应页号的比特位个数
+    static const int kRootLength = 1 << kRootBits;     // 第一层存储元素的个数
+
+    struct Leaf {
+        std::atomic<void*>    values_[kLeafLength];
+        std::atomic<uint8_t>  sizeClasses_[kLeafLength];
+        std::atomic<uint16_t> origins_[kLeafLength];
+    };
+
+    // 不显式初始化 避免构造时写入整个数组 因此只能定义在零初始化的静态存储区中
+    std::atomic<Leaf*> root_[kRootLength];
+
+public:
+    TwoLevelRadixTree()                                    = default;
+    TwoLevelRadixTree(const TwoLevelRadixTree&)            = delete;
+    TwoLevelRadixTree& operator=(const TwoLevelRadixTree&) = delete;
+
+    void* get(idx_t idx) const {
+        // 页号超出范围
+        if ((idx >> BITS) > 0) {
+            return nullptr;
+        }
+        // 与ensure()中的release配对 保证读到的叶子节点已经初始化完成
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            return nullptr;
+        }
+        // 与set()中的release配对 保证读到的Span已经初始化完成
+        return leaf->values_[idx & (kLeafLength - 1)].load(std::memory_order_acquire);
+    }
+
+    void set(idx_t idx, void* ptr) {
+        assert(idx >> BITS == 0);
+        ensure(idx, 1); // 确保映射第_idx页页号的空间是开辟好了的
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_relaxed);
+        leaf->values_[idx & (kLeafLength - 1)].store(ptr, std::memory_order_release);
+    }
+
+    /**
+     * @brief 获取第_idx页记录的哈希桶下标，未记录时为0
+     * @details 记录在对象被分配出去之前完成，释放对象的线程与分配时建立的同步关系保证了可见性
+     */
+    size_t getSizeClass(idx_t idx) const {
+        if ((idx >> BITS) > 0) {
+            return 0;
+        }
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            return 0;
+        }
+        return leaf->sizeClasses_[idx & (kLeafLength - 1)].load(std::memory_order_relaxed);
+    }
+
+    void setSizeClass(idx_t idx, uint8_t cl) {
+        assert(idx >> BITS == 0);
+        ensure(idx, 1);
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_relaxed);
+        leaf->sizeClasses_[idx & (kLeafLength - 1)].store(cl, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 获取第_idx页记录的ThreadCache编号，未记录时为0
+     * @details 只作为归还对象时的提示，读到旧值也不影响正确性
+     */
+    size_t getOrigin(idx_t idx) const {
+        if ((idx >> BITS) > 0) {
+            return 0;
+        }
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            return 0;
+        }
+        return leaf->origins_[idx & (kLeafLength - 1)].load(std::memory_order_relaxed);
+    }
+
+    void setOrigin(idx_t idx, uint16_t id) {
+        assert(idx >> BITS == 0);
+        ensure(idx, 1);
+        Leaf* leaf = root_[idx >> kLeafBits].load(std::memory_order_relaxed);
+        leaf->origins_[idx & (kLeafLength - 1)].store(id, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 确保[_start, _start+_n-1]页号的空间是开辟好的
+     * @details 可以在获得新的内存时提前调用，使得后续的set()不再需要开辟叶子节点
+     */
+    bool ensure(idx_t start, size_t n) {
+        for (idx_t key = start; key <= start + n - 1;) {
+            const idx_t idx_root = key >> kLeafBits;
+            // 下标值超出范围
+            if (idx_root >= kRootLength) {
+                return false;
+            }
+            if (root_[idx_root].load(std::memory_order_acquire) == nullptr) {
+                // 系统返回的内存已经清零 且只有被访问到的页才会占用物理内存
+                Leaf* leaf     = static_cast<Leaf*>(systemAlloc(sizeof(Leaf) >> kPageShift));
+                Leaf* expected = nullptr;
+                if (!root_[idx_root].compare_exchange_strong(expected, leaf, std::memory_order_release,
+                                                             std::memory_order_acquire)) {
+                    // 其它分片已经开辟了该叶子节点
+                    systemFree(leaf, sizeof(Leaf) >> kPageShift);
+                }
+            }
+            key = (idx_root + 1) << kLeafBits; // 继续后续检查
+        }
+        return true;
+    }
+};
+
+#if defined(_WIN64) || defined(__x86_64__) || defined(__aarch64__)
+// 用户态地址只有48位 使用两层的基数树
+using PageMap = TwoLevelRadixTree<48 - kPageShift>;
 #elif _WIN32
 using PageMap = RadixTree<32 - kPageShift>;
 #elif __linux__
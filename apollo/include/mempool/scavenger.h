@@ -0,0 +1,70 @@
+#ifndef __APOLLO_SCAVENGER_H__
+#define __APOLLO_SCAVENGER_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace apollo {
+/**
+ * @brief 空闲页回收器
+ * @details 后台线程周期性地将PageCache中空闲足够久的Span归还给操作系统，
+ * 并按照每秒归还的字节数进行限速，使得流量高峰过后进程的内存占用能够回落。
+ * 每个周期还会将各线程远程释放队列中滞留的对象还给CentralCache
+ */
+class Scavenger {
+public:
+    static Scavenger* getInstance() {
+        static Scavenger scavenger;
+        return &scavenger;
+    }
+
+    /**
+     * @brief 按照配置文件中的内存池配置启动回收线程
+     * @details 重复启动无效，回收速率为0时不启动
+     */
+    void start();
+
+    /**
+     * @brief 启动回收线程
+     *
+     * @param releaseRate 每秒最多归还给操作系统的字节数，为0时不启动
+     * @param releaseAge 空闲页的最短空闲时间，单位为秒
+     * @param interval 回收线程的执行间隔，单位为秒
+     */
+    void start(size_t releaseRate, uint32_t releaseAge, uint32_t interval);
+
+    /**
+     * @brief 停止回收线程
+     */
+    void stop();
+
+    /**
+     * @brief 回收线程是否正在运行
+     */
+    bool running() const { return running_; }
+
+private:
+    Scavenger();
+    Scavenger(const Scavenger&)            = delete;
+    Scavenger& operator=(const Scavenger&) = delete;
+    ~Scavenger();
+
+    /**
+     * @brief 回收线程的执行函数
+     */
+    void threadFunc();
+
+private:
+    std::thread             thread_;       // 回收线程
+    std::mutex              mtx_;          // 保护回收线程的状态
+    std::condition_variable cond_;         // 用于唤醒回收线程退出
+    bool                    running_;      // 回收线程是否正在运行
+    size_t                  releaseRate_;  // 每秒最多归还的字节数
+    uint64_t                releaseAgeMs_; // 空闲页的最短空闲时间，单位为毫秒
+    uint32_t                interval_;     // 回收线程的执行间隔，单位为秒
+};
+} // namespace apollo
+
+#endif // !__APOLLO_SCAVENGER_H__
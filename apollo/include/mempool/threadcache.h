@@ -4,9 +4,18 @@
 #include "utilis.h"
 
 namespace apollo {
+struct MallocStats;
+struct RemoteQueues;
+
 /**
  * @brief 线程缓存对象
- * @details 线程独享，无需锁变量。其允许申请的最大内存为256KB
+ * @details 线程独享，无需锁变量。其允许申请的最大内存为256KB。
+ * 所有ThreadCache共享一个总容量，每个ThreadCache缓存的字节数超过其容量时，
+ * 归还各个自由链表中长期未被用到的对象，并从未分配的容量或其它线程处窃取一部分容量。
+ * 线程退出时其缓存的对象全部归还给CentralCache，ThreadCache对象本身归还给对象池。
+ * 开启APLNUMA选项后，ThreadCache创建时绑定到线程所在的NUMA节点，只与该节点的CentralCache交换对象。
+ * 每个线程的ThreadCache有一个编号，从Span中取出对象时记录在对象所在的页上；自由链表过长而归还对象时，
+ * 由其它线程取走的对象按编号整批送入其来源线程的远程释放队列，由来源线程在下次向CentralCache申请之前取回
  */
 class ThreadCache {
 public:
@@ -14,6 +23,39 @@ public:
     ThreadCache(const ThreadCache&)            = delete;
     ThreadCache& operator=(const ThreadCache&) = delete;
 
+    /**
+     * @brief 获取当前线程专属的ThreadCache对象，不存在时创建
+     */
+    static ThreadCache* getInstance() {
+        // 通过TLS，每个线程无锁的获取自己专属的ThreadCache对象
+        if (tlsThreadCache_ == nullptr) {
+            return create();
+        }
+        return tlsThreadCache_;
+    }
+
+    /**
+     * @brief 获取当前线程专属的ThreadCache对象，不存在时返回空指针
+     */
+    static ThreadCache* current() { return tlsThreadCache_; }
+
+    /**
+     * @brief 将所有线程的远程释放队列中的对象还给CentralCache
+     * @details 由回收线程周期性地调用，避免长期不申请内存的线程的队列中滞留对象
+     */
+    static void releaseRemoteQueues();
+
+    /**
+     * @brief 获取用于释放对象的ThreadCache对象
+     * @details 与getInstance()相同，但线程退出并回收了ThreadCache之后返回空指针而不再重新创建
+     */
+    static ThreadCache* getInstanceForFree() {
+        if (tlsThreadCache_ == nullptr && !tlsExited_) {
+            return create();
+        }
+        return tlsThreadCache_;
+    }
+
     /**
      * @brief 申请内存对象
      */
@@ -27,6 +69,43 @@ public:
      */
     void deallocate(void* ptr, size_t size);
 
+    /**
+     * @brief 获取绑定的NUMA节点
+     */
+    size_t node() const { return node_; }
+
+    /**
+     * @brief 绑定到_node节点，须在缓存任何对象之前调用
+     */
+    void bindNode(size_t node) { node_ = node; }
+
+    /**
+     * @brief 设置所有ThreadCache缓存的总字节数上限
+     * @details 已有的ThreadCache不会立即缩小，而是在之后的回收和窃取中逐渐收敛到新的上限
+     */
+    static void setOverallCacheSize(size_t bytes);
+
+    /**
+     * @brief 获取所有ThreadCache缓存的总字节数上限
+     */
+    static size_t overallCacheSize();
+
+    /**
+     * @brief 将不属于任何线程的ThreadCache(如CpuCache的槽位)纳入总容量的管理
+     * @details 从未分配的总容量中扣除其初始容量，并使其参与容量的窃取
+     */
+    static void registerCache(ThreadCache* cache);
+
+    /**
+     * @brief 将该ThreadCache中缓存的字节数累加到统计信息中
+     */
+    void addStats(MallocStats& stats) const;
+
+    /**
+     * @brief 收集所有线程的ThreadCache的统计信息
+     */
+    static void collectStats(MallocStats& stats);
+
 private:
     /**
      * @brief 向CentralCache申请对象
@@ -37,15 +116,111 @@ private:
     void* fetchFromCentralCache(size_t index, size_t size);
 
     /**
-     * @brief 将FreeList对象归还给CentralCache
+     * @brief 取回其它线程送回的_index哈希桶中的对象，放入对应的自由链表
+     * @return 取回了对象时返回true
+     */
+    bool drainRemote(size_t index, size_t size);
+
+    /**
+     * @brief 将自由链表中取出的一批对象归还
+     * @details 按对象所在页记录的来源分组，来源为其它线程的对象整批送入其远程释放队列，
+     * 队列已满或来源为本线程、未知的对象整批还给CentralCache。最多送往kMaxRemoteGroups个来源
+     *
+     * @param _start 以nullptr结尾的对象链表
+     * @param _size 对象的大小
+     */
+    void returnRange(void* start, size_t size);
+
+    /**
+     * @brief 将远程释放队列中的对象全部还给CentralCache
+     *
+     * @param _close 是否同时关闭队列，关闭后其它线程不再向其中送入对象
+     */
+    void releaseRemote(bool close);
+
+    /**
+     * @brief 为cache分配编号及远程释放队列，编号用完时为0，调用者需持有s_poolmtx
+     */
+    static void attachRemoteLocked(ThreadCache* cache);
+
+    /**
+     * @brief 将_cnt个对象整批送入编号为_id的ThreadCache的远程释放队列
+     * @return 队列不存在、已关闭、不属于_node节点或者其中的对象数已达到_limit时返回false
+     */
+    static bool pushRemote(size_t id, size_t node, size_t index, void* start, void* end, size_t cnt, size_t limit);
+
+    /**
+     * @brief 将自由链表头部的_cnt个对象归还给CentralCache或其来源线程
+     * @details 每批不超过一次批量移动的对象个数，以便TransferCache中的每批对象都能被整批取走
      *
      * @param _list 要归还的自由链表
      * @param _size 自由链表中内存块的大小
+     * @param _cnt 归还的对象个数
      */
-    void revertListToCentralCache(FreeList& list, size_t size);
+    void revertListToCentralCache(FreeList& list, size_t size, size_t cnt);
+
+    /**
+     * @brief 自由链表的长度超过maxSize时调用
+     * @details 只归还一批对象，并根据超出的频率调整maxSize，避免在边界处反复申请和归还
+     */
+    void listTooLong(FreeList& list, size_t size);
+
+    /**
+     * @brief 缓存的字节数超过容量时调用
+     * @details 归还每个自由链表自上次回收以来从未被用到的对象的一半，然后尝试扩大容量
+     */
+    void scavenge();
+
+    /**
+     * @brief 从未分配的总容量中领取，或从其它ThreadCache处窃取一部分容量
+     */
+    void increaseCacheLimit();
+
+    /**
+     * @brief 将所有自由链表中的对象归还给CentralCache
+     */
+    void releaseAll();
+
+    /**
+     * @brief 扣除cache的初始容量并将其加入链表，调用者需持有s_poolmtx
+     */
+    static void linkLocked(ThreadCache* cache);
+
+    /**
+     * @brief 为当前线程创建ThreadCache对象，并注册线程退出时的回收函数
+     */
+    static ThreadCache* create();
+
+    /**
+     * @brief 线程退出时回收其ThreadCache对象
+     */
+    static void destroy(void* cache);
 
 private:
-    FreeList freelists_[kBucketSize];
+    /// 单个ThreadCache容量的下限
+    static constexpr size_t kMinCacheSize = kMaxBytes * 2;
+    /// 每次扩大容量的字节数
+    static constexpr size_t kStealAmount = 64 * 1024;
+    /// 自由链表maxSize的上限
+    static constexpr size_t kMaxFreeListLength = 8192;
+    /// 自由链表长度超过maxSize多少次后缩小maxSize
+    static constexpr size_t kMaxOverages = 3;
+    /// 远程释放队列中每个哈希桶最多缓存的批数，超过后直接还给CentralCache
+    static constexpr size_t kMaxRemoteBatches = 4;
+    /// 归还一批对象时最多送往的来源个数
+    static constexpr size_t kMaxRemoteGroups = 4;
+
+    FreeList            freelists_[kBucketSize];
+    size_t              size_    = 0;             // 缓存的字节数
+    std::atomic<size_t> maxSize_ = kMinCacheSize; // 容量，可能被其它线程窃取
+    size_t              node_    = 0;             // 绑定的NUMA节点
+    uint16_t            id_      = 0;             // 编号，为0时不记录对象的来源
+    RemoteQueues*       remote_  = nullptr;       // 其它线程送回的对象
+    ThreadCache*        prev_    = nullptr;       // 所有线程的ThreadCache组成的双向链表
+    ThreadCache*        next_    = nullptr;
+
+    static TLS ThreadCache* tlsThreadCache_;
+    static TLS bool         tlsExited_; // 本线程的ThreadCache是否已在线程退出时回收
 };
 } // namespace apollo
 
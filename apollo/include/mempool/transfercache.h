@@ -0,0 +1,101 @@
+#ifndef __APOLLO_TRANSFER_CACHE_H__
+#define __APOLLO_TRANSFER_CACHE_H__
+
+#include "utilis.h"
+
+namespace apollo {
+/**
+ * @brief 传输缓存
+ * @details 位于ThreadCache与CentralCache的Span之间，每个大小等级一个。
+ * 缓存若干批由ThreadCache归还的、已经串成链表的对象，ThreadCache批量申请
+ * 或归还对象时只需在自旋锁内交换一批对象的首尾指针，无需逐个对象访问Span
+ */
+class TransferCache {
+public:
+    TransferCache()
+        : capacity_(0)
+        , size_(0) { }
+    TransferCache(const TransferCache&)            = delete;
+    TransferCache& operator=(const TransferCache&) = delete;
+
+    /**
+     * @brief 按照对象大小设置可缓存的批次数
+     * @details 每个大小等级缓存的字节数不超过kMaxCachedBytes
+     * @param size 对象的大小
+     */
+    void init(size_t size) {
+        size_t batchbytes = AlignHelper::numMoveSize(size) * size;
+        capacity_         = kMaxCachedBytes / batchbytes;
+        if (capacity_ < 1) capacity_ = 1;
+        if (capacity_ > kMaxBatches) capacity_ = kMaxBatches;
+    }
+
+    /**
+     * @brief 缓存一批对象
+     *
+     * @param start 连续对象的起始地址
+     * @param end 连续对象的末尾地址
+     * @param cnt 对象的个数
+     * @return 缓存已满时返回false
+     */
+    bool insertRange(void* start, void* end, size_t cnt) {
+        std::lock_guard<SpinLock> lock(lock_);
+        if (size_ >= capacity_) {
+            return false;
+        }
+        batches_[size_++] = { start, end, cnt };
+        return true;
+    }
+
+    /**
+     * @brief 取出最近缓存的一批对象
+     *
+     * @param start 传出参数，连续对象的起始地址
+     * @param end 传出参数，连续对象的末尾地址
+     * @param cnt 最多需要的对象个数
+     * @return 返回取出的对象个数，该批对象多于cnt个时不取出并返回0
+     */
+    size_t removeRange(void*& start, void*& end, size_t cnt) {
+        std::lock_guard<SpinLock> lock(lock_);
+        if (size_ == 0 || batches_[size_ - 1].cnt_ > cnt) {
+            return 0;
+        }
+        const Batch& batch = batches_[--size_];
+        start              = batch.start_;
+        end                = batch.end_;
+        return batch.cnt_;
+    }
+
+    /**
+     * @brief 返回缓存的对象总数
+     */
+    size_t objects() {
+        std::lock_guard<SpinLock> lock(lock_);
+        size_t                    cnt = 0;
+        for (size_t i = 0; i < size_; i++) {
+            cnt += batches_[i].cnt_;
+        }
+        return cnt;
+    }
+
+private:
+    static const size_t kMaxBatches     = 64;         // 最多缓存的批次数
+    static const size_t kMaxCachedBytes = 1024 * 1024; // 每个大小等级最多缓存的字节数
+
+    /**
+     * @brief 一批串成链表的对象
+     */
+    struct Batch {
+        void*  start_; // 起始对象
+        void*  end_;   // 末尾对象
+        size_t cnt_;   // 对象个数
+    };
+
+    SpinLock lock_;
+    size_t   capacity_;             // 可缓存的批次数
+    size_t   size_;                 // 已缓存的批次数
+    Batch    batches_[kMaxBatches]; // 以栈的方式缓存，后进先出有利于缓存命中
+};
+} // namespace apollo
+
+#endif // !__APOLLO_TRANSFER_CACHE_H__
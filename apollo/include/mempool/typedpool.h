@@ -0,0 +1,220 @@
+#ifndef __APOLLO_TYPED_POOL_H__
+#define __APOLLO_TYPED_POOL_H__
+
+#include "utilis.h"
+#include <new>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace apollo {
+/**
+ * @brief 定长对象池，线程安全
+ * @details 每个线程持有两个弹匣(magazine)，每个弹匣最多缓存kMagazineSize个对象，申请和释放只在本线程的弹匣中进行，无需加锁；
+ * 两个弹匣都空或都满时才加锁与全局的仓库交换一整个弹匣。在一个线程申请、另一个线程释放的对象以整个弹匣为单位流回申请者。
+ * 仓库中满弹匣的数目超过上限时，多出的对象归还给全局的内存分配器，因此池中缓存的内存是有界的。
+ * 线程退出时其弹匣归还给仓库
+ */
+template <typename T>
+class TypedPool {
+public:
+    /**
+     * @brief 申请一个T对象大小的未初始化内存
+     */
+    static void* allocate() {
+        Magazine* mag = tlsLoaded_;
+        if (mag != nullptr && mag->count_ > 0) {
+            return mag->objs_[--mag->count_];
+        }
+        return allocateSlow();
+    }
+
+    /**
+     * @brief 释放由allocate申请的内存，可以在任意线程中调用
+     */
+    static void deallocate(void* ptr) {
+        Magazine* mag = tlsLoaded_;
+        if (mag != nullptr && mag->count_ < kMagazineSize) {
+            mag->objs_[mag->count_++] = ptr;
+            return;
+        }
+        deallocateSlow(ptr);
+    }
+
+private:
+    /// 每个弹匣缓存的对象个数
+    static const size_t kMagazineSize = 32;
+    /// 仓库中满弹匣的数目上限
+    static const size_t kMaxFullMagazines = 64;
+
+    struct Magazine {
+        size_t    count_;
+        void*     objs_[kMagazineSize];
+        Magazine* next_;
+    };
+
+    /**
+     * @brief 全局的弹匣仓库
+     */
+    struct Depot {
+        std::mutex           mtx_;
+        Magazine*            full_      = nullptr; // 非空的弹匣，可能未满
+        Magazine*            empty_     = nullptr; // 空弹匣
+        size_t               fullCount_ = 0;
+        ObjectPool<Magazine> pool_;
+#ifdef __linux__
+        pthread_key_t key_;
+
+        Depot() { pthread_key_create(&key_, &TypedPool::threadExit); }
+#endif
+    };
+
+    static Depot& depot() {
+        static Depot depot;
+        return depot;
+    }
+
+    /**
+     * @brief 从仓库中取出一个空弹匣，没有时新建一个，调用者需持有仓库的锁
+     */
+    static Magazine* takeEmpty(Depot& d) {
+        Magazine* mag = d.empty_;
+        if (mag != nullptr) {
+            d.empty_ = mag->next_;
+        } else {
+            mag = d.pool_.alloc();
+        }
+        mag->count_ = 0;
+        return mag;
+    }
+
+    /**
+     * @brief 将弹匣放回仓库，调用者需持有仓库的锁
+     * @details 满弹匣的数目已达上限时，其中的对象归还给全局的内存分配器
+     */
+    static void putBack(Depot& d, Magazine* mag) {
+        if (mag->count_ > 0 && d.fullCount_ >= kMaxFullMagazines) {
+            for (size_t i = 0; i < mag->count_; i++) {
+                ::operator delete(mag->objs_[i]);
+            }
+            mag->count_ = 0;
+        }
+        if (mag->count_ > 0) {
+            mag->next_ = d.full_;
+            d.full_    = mag;
+            d.fullCount_++;
+        } else {
+            mag->next_ = d.empty_;
+            d.empty_   = mag;
+        }
+    }
+
+    /**
+     * @brief 本线程第一次使用时分配两个空弹匣
+     */
+    static void initThread() {
+        Depot& d = depot();
+        {
+            std::lock_guard<std::mutex> lock(d.mtx_);
+            tlsLoaded_   = takeEmpty(d);
+            tlsPrevious_ = takeEmpty(d);
+        }
+#ifdef __linux__
+        // 线程退出时归还弹匣 回收函数只在键值非空时调用
+        pthread_setspecific(d.key_, tlsLoaded_);
+#endif
+    }
+
+    static void* allocateSlow() {
+        if (tlsLoaded_ == nullptr) {
+            initThread();
+        }
+        // 另一个弹匣中还有对象时直接交换
+        if (tlsPrevious_->count_ > 0) {
+            std::swap(tlsLoaded_, tlsPrevious_);
+            return tlsLoaded_->objs_[--tlsLoaded_->count_];
+        }
+        // 用空弹匣从仓库中换一个非空的弹匣
+        Depot& d = depot();
+        {
+            std::lock_guard<std::mutex> lock(d.mtx_);
+            if (d.full_ != nullptr) {
+                Magazine* full = d.full_;
+                d.full_        = full->next_;
+                d.fullCount_--;
+                putBack(d, tlsLoaded_);
+                tlsLoaded_ = full;
+                return tlsLoaded_->objs_[--tlsLoaded_->count_];
+            }
+        }
+        // 仓库中也没有缓存的对象时向全局的内存分配器申请
+        return ::operator new(sizeof(T));
+    }
+
+    static void deallocateSlow(void* ptr) {
+        if (tlsLoaded_ == nullptr) {
+            initThread();
+        }
+        // 另一个弹匣未满时直接交换
+        if (tlsPrevious_->count_ < kMagazineSize) {
+            std::swap(tlsLoaded_, tlsPrevious_);
+            tlsLoaded_->objs_[tlsLoaded_->count_++] = ptr;
+            return;
+        }
+        // 两个弹匣都满时将其中一个放回仓库 换一个空弹匣
+        Depot& d = depot();
+        {
+            std::lock_guard<std::mutex> lock(d.mtx_);
+            putBack(d, tlsLoaded_);
+            tlsLoaded_ = takeEmpty(d);
+        }
+        tlsLoaded_->objs_[tlsLoaded_->count_++] = ptr;
+    }
+
+    /**
+     * @brief 线程退出时将其弹匣归还给仓库
+     */
+    static void threadExit(void*) {
+        Depot&                      d = depot();
+        std::lock_guard<std::mutex> lock(d.mtx_);
+        putBack(d, tlsLoaded_);
+        putBack(d, tlsPrevious_);
+        tlsLoaded_   = nullptr;
+        tlsPrevious_ = nullptr;
+    }
+
+private:
+    static TLS Magazine* tlsLoaded_;   // 当前使用的弹匣
+    static TLS Magazine* tlsPrevious_; // 备用的弹匣
+};
+
+template <typename T>
+TLS typename TypedPool<T>::Magazine* TypedPool<T>::tlsLoaded_ = nullptr;
+template <typename T>
+TLS typename TypedPool<T>::Magazine* TypedPool<T>::tlsPrevious_ = nullptr;
+
+/**
+ * @brief 继承该类即可使T的new和delete经由TypedPool<T>申请和释放
+ * @details 大小与T不同的派生类仍使用全局的operator new和operator delete
+ */
+template <typename T>
+class PoolAllocated {
+public:
+    static void* operator new(size_t size) {
+        return size == sizeof(T) ? TypedPool<T>::allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        if (ptr == nullptr) {
+            return;
+        }
+        if (size == sizeof(T)) {
+            TypedPool<T>::deallocate(ptr);
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+};
+} // namespace apollo
+
+#endif // !__APOLLO_TYPED_POOL_H__
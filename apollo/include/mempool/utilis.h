@@ -1,13 +1,17 @@
 #ifndef __APOLLO_UTILTS_H__
 #define __APOLLO_UTILTS_H__
 
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <mutex>
 #include <new>
+#include <thread>
 
 #ifdef _WIN32
 #include <Windows.h>
 #elif __linux__
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
@@ -19,6 +23,16 @@ static const size_t kMaxBytes = 256 * 1024;
 static const size_t kBucketSize = 208;
 /// PageCache中哈希桶的数目
 static const size_t kPageBucketSize = 129;
+/// 每个NUMA节点中PageCache分片的数目
+static const size_t kPageShards = 8;
+/// 支持的NUMA节点数目的上限
+#ifdef APLNUMA
+static const size_t kMaxNumaNodes = 8;
+#else
+static const size_t kMaxNumaNodes = 1;
+#endif
+/// 所有NUMA节点中PageCache分片的总数
+static const size_t kTotalPageShards = kPageShards * kMaxNumaNodes;
 /// 页大小偏移转换 即2的12次方为4096 即一页的大小
 static const size_t kPageShift = 12;
 
@@ -43,9 +57,12 @@ using page_t = unsigned long long;
  */
 inline static void* systemAlloc(size_t npage) {
 #ifdef _WIN32
-    void* ptr = VirtualAlloc(0, _npage * (1 << kPageShift), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    void* ptr = VirtualAlloc(0, npage * (1 << kPageShift), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #elif __linux__
-    void* ptr = sbrk(npage * (1 << kPageShift));
+    void* ptr = mmap(nullptr, npage * (1 << kPageShift), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        ptr = nullptr;
+    }
 #endif
     if (ptr == nullptr) {
         throw std::bad_alloc();
@@ -56,14 +73,42 @@ inline static void* systemAlloc(size_t npage) {
 /**
  * @brief 调用系统接口释放内存
  */
-inline static void systemFree(void* ptr) {
+inline static void systemFree(void* ptr, size_t npage) {
 #ifdef _WIN32
-    VirtualFree(_ptr, 0, MEM_RELEASE);
+    VirtualFree(ptr, 0, MEM_RELEASE);
 #elif __linux__
-    brk(ptr);
+    munmap(ptr, npage * (1 << kPageShift));
 #endif
 }
 
+/**
+ * @brief 自旋锁
+ * @details 用于保护临界区极短的数据结构，可配合std::lock_guard使用
+ */
+class SpinLock {
+public:
+    SpinLock()                           = default;
+    SpinLock(const SpinLock&)            = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+
+    void lock() {
+        // 自旋一段时间仍未获取到锁时让出CPU
+        for (size_t spins = 0; flag_.test_and_set(std::memory_order_acquire); spins++) {
+            if (spins >= kSpinCount) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock() { return !flag_.test_and_set(std::memory_order_acquire); }
+    void unlock() { flag_.clear(std::memory_order_release); }
+
+private:
+    static const size_t kSpinCount = 64;
+
+    std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
 /**
  * @breif 访问下一个对象
  */
@@ -83,6 +128,10 @@ inline static void*& nextObj(void* ptr) {
  *	[8K+1, 64K]       1024        [128, 184)
  *	[64K+1, 256K]     8K          [184, 208)
  *  ======================================
+ * 上述规则在编译期展开为查找表：不超过1024字节时以(bytes+7)>>3作为下标，
+ * 超过1024字节时以(bytes+127+(120<<7))>>7作为下标，两段下标连续，
+ * 因此字节数到哈希桶下标的映射只需一次查表。每个哈希桶对应的对齐后字节数、
+ * 批量申请的对象个数以及页数也都预先计算好
  */
 class AlignHelper {
 public:
@@ -90,16 +139,8 @@ public:
      * @brief 获取向上对齐后的字节数
      */
     static inline size_t roundUp(size_t bytes) {
-        if (bytes <= 128) {
-            return _roundUp(bytes, 8);
-        } else if (bytes <= 1024) {
-            return _roundUp(bytes, 16);
-        } else if (bytes <= 8 * 1024) {
-            return _roundUp(bytes, 128);
-        } else if (bytes <= 64 * 1024) {
-            return _roundUp(bytes, 1024);
-        } else if (bytes <= 256 * 1024) {
-            return _roundUp(bytes, 8 * 1024);
+        if (bytes <= kMaxBytes) {
+            return kTable.classSize_[index(bytes)];
         } else {
             // 大于256KB的按页对齐
             return _roundUp(bytes, 1 << kPageShift);
@@ -110,57 +151,55 @@ public:
      * @brief 获取对应的哈希桶的下标
      */
     static inline size_t index(size_t bytes) {
-        // 每个区间内的自由链表数目
-        static size_t group[4] = { 16, 56, 56, 56 };
+        assert(bytes <= kMaxBytes);
+        return kTable.classIndex_[classArrayIndex(bytes)];
+    }
 
-        if (bytes <= 128) {
-            return _index(bytes, 3);
-        } else if (bytes <= 1024) {
-            return _index(bytes - 128, 4) + group[0];
-        } else if (bytes <= 8 * 1024) {
-            return _index(bytes - 1024, 7) + group[0] + group[1];
-        } else if (bytes <= 64 * 1024) {
-            return _index(bytes - 8 * 1024, 10) + group[0] + group[1] + group[2];
-        } else if (bytes <= 256 * 1024) {
-            return _index(bytes - 64 * 1024, 13) + group[0] + group[1] + group[2] + group[3];
-        } else {
-            assert(false);
-            return -1;
-        }
+    /**
+     * @brief 获取哈希桶中对象的大小，即对齐后的字节数
+     */
+    static inline size_t classSize(size_t index) {
+        assert(index < kBucketSize);
+        return kTable.classSize_[index];
     }
 
     /**
      * @brief 获取CentralCache实际应给ThreadCache的具体的对象个数
      * @details 通过慢开始反馈调节算法，将对象数目控制在2~512个之间
      */
-    static size_t numMoveSize(size_t size) {
+    static inline size_t numMoveSize(size_t size) {
         assert(size > 0);
+        return kTable.numMoveSize_[index(size)];
+    }
 
-        // 对象越小，计算出的上限越高
-        // 对象越大，计算出的上限越低
-        int num = kMaxBytes / size;
-        if (num < 2)
-            num = 2;
-        if (num > 512)
-            num = 512;
-
-        return num;
+    /**
+     * @brief 获取CentralCache一次向PageCache申请的页数
+     */
+    static inline size_t numMovePage(size_t size) {
+        return kTable.numMovePage_[index(size)];
     }
 
-    static size_t numMovePage(size_t size) {
-        size_t num = numMoveSize(size); // 计算出ThreadCache一次向CentralCache申请对象的个数上限
-        // 先计算num个size大小的对象所需的字节数 然后将字节数转化为页数
-        size_t npage = (num * size) >> kPageShift;
+private:
+    /// 查找表的长度
+    static constexpr size_t kClassArraySize = ((kMaxBytes + 127 + (120 << 7)) >> 7) + 1;
 
-        if (npage == 0) // 至少给一页
-        {
-            npage = 1;
-        }
+    /**
+     * @brief 编译期生成的查找表
+     */
+    struct SizeClassTable {
+        uint8_t  classIndex_[kClassArraySize]; // 字节数对应的哈希桶下标
+        uint32_t classSize_[kBucketSize];      // 哈希桶中对象的大小
+        uint16_t numMoveSize_[kBucketSize];    // 一次批量申请的对象个数
+        uint16_t numMovePage_[kBucketSize];    // 一次批量申请的页数
+    };
 
-        return npage;
+    /**
+     * @brief 获取字节数在查找表中的下标
+     */
+    static constexpr size_t classArrayIndex(size_t bytes) {
+        return bytes <= 1024 ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
     }
 
-private:
     /**
      * @brief 获取向上对齐后的字节数
      *
@@ -168,7 +207,7 @@ private:
      * @param _align 对齐数
      * @return 返回对齐后的字节数
      */
-    static inline size_t _roundUp(size_t bytes, size_t align) {
+    static constexpr size_t _roundUp(size_t bytes, size_t align) {
         return ((bytes + align - 1) & ~(align - 1));
     }
 
@@ -179,11 +218,87 @@ private:
      * @param _align 将对齐数转换为2的n次方的形式 例如对齐数为8 则传入3
      * @return 返回字节数对应的哈希桶下标
      */
-    static inline size_t _index(size_t bytes, size_t alignShift) {
+    static constexpr size_t _index(size_t bytes, size_t alignShift) {
         return ((bytes + (1 << alignShift) - 1) >> alignShift) - 1;
     }
+
+    /**
+     * @brief 按照对齐规则计算对齐后的字节数，仅用于生成查找表
+     */
+    static constexpr size_t computeRoundUp(size_t bytes) {
+        if (bytes <= 128) {
+            return _roundUp(bytes, 8);
+        } else if (bytes <= 1024) {
+            return _roundUp(bytes, 16);
+        } else if (bytes <= 8 * 1024) {
+            return _roundUp(bytes, 128);
+        } else if (bytes <= 64 * 1024) {
+            return _roundUp(bytes, 1024);
+        } else {
+            return _roundUp(bytes, 8 * 1024);
+        }
+    }
+
+    /**
+     * @brief 按照对齐规则计算哈希桶的下标，仅用于生成查找表
+     */
+    static constexpr size_t computeIndex(size_t bytes) {
+        // 每个区间内的自由链表数目分别为16、56、56、56
+        if (bytes <= 128) {
+            return _index(bytes, 3);
+        } else if (bytes <= 1024) {
+            return _index(bytes - 128, 4) + 16;
+        } else if (bytes <= 8 * 1024) {
+            return _index(bytes - 1024, 7) + 16 + 56;
+        } else if (bytes <= 64 * 1024) {
+            return _index(bytes - 8 * 1024, 10) + 16 + 56 + 56;
+        } else {
+            return _index(bytes - 64 * 1024, 13) + 16 + 56 + 56 + 56;
+        }
+    }
+
+    /**
+     * @brief 生成查找表
+     */
+    static constexpr SizeClassTable makeTable() {
+        SizeClassTable table {};
+
+        // 每个下标覆盖的字节数区间内对齐规则相同 取区间内最大的字节数计算
+        table.classIndex_[0] = 0; // 0字节按照1字节处理
+        for (size_t i = 1; i < kClassArraySize; i++) {
+            size_t bytes         = i <= 128 ? i << 3 : (i << 7) - (120 << 7);
+            table.classIndex_[i] = static_cast<uint8_t>(computeIndex(bytes));
+        }
+
+        for (size_t bytes = 1; bytes <= kMaxBytes; bytes = computeRoundUp(bytes) + 1) {
+            size_t index = computeIndex(bytes);
+            size_t size  = computeRoundUp(bytes);
+
+            // 对象越小，计算出的上限越高
+            // 对象越大，计算出的上限越低
+            size_t num = kMaxBytes / size;
+            if (num < 2)
+                num = 2;
+            if (num > 512)
+                num = 512;
+
+            // 先计算num个size大小的对象所需的字节数 然后将字节数转化为页数 至少给一页
+            size_t npage = (num * size) >> kPageShift;
+            if (npage == 0)
+                npage = 1;
+
+            table.classSize_[index]   = static_cast<uint32_t>(size);
+            table.numMoveSize_[index] = static_cast<uint16_t>(num);
+            table.numMovePage_[index] = static_cast<uint16_t>(npage);
+        }
+        return table;
+    }
+
+    static const SizeClassTable kTable;
 };
 
+inline constexpr AlignHelper::SizeClassTable AlignHelper::kTable = AlignHelper::makeTable();
+
 /**
  * @brief 管理小内存块的自由链表
  */
@@ -192,7 +307,9 @@ public:
     FreeList()
         : freelist_(nullptr)
         , maxSize_(1)
-        , size_(0) { }
+        , size_(0)
+        , lowWater_(0)
+        , overages_(0) { }
 
     /**
      * @brief 将对象头插到自由链表中
@@ -202,6 +319,7 @@ public:
 
         nextObj(obj) = freelist_;
         freelist_     = obj;
+        ++size_;
     }
 
     /**
@@ -212,6 +330,9 @@ public:
 
         void* obj = freelist_;
         freelist_ = nextObj(freelist_);
+        if (--size_ < lowWater_) {
+            lowWater_ = size_;
+        }
         return obj;
     }
 
@@ -251,10 +372,14 @@ public:
         freelist_     = nextObj(end); // 自由链表指向end的下一个对象
         nextObj(end) = nullptr;       // 取出的一段链表的表尾置空
         size_ -= cnt;
+        if (size_ < lowWater_) {
+            lowWater_ = size_;
+        }
     }
 
     void* clear() {
         size_      = 0;
+        lowWater_  = 0;
         void* list = freelist_;
         freelist_  = nullptr;
         return list;
@@ -265,10 +390,25 @@ public:
     void   setMaxSize(size_t _size) { maxSize_ = _size; }
     size_t size() const { return size_; }
 
+    /**
+     * @brief 返回自上次调用resetLowWater以来自由链表长度的最小值
+     * @details 这部分对象在这段时间内从未被用到，可以归还给CentralCache
+     */
+    size_t lowWater() const { return lowWater_; }
+    void   resetLowWater() { lowWater_ = size_; }
+
+    /**
+     * @brief 自由链表长度超过maxSize的次数，用于判断是否需要缩小maxSize
+     */
+    size_t overages() const { return overages_; }
+    void   setOverages(size_t overages) { overages_ = overages; }
+
 private:
     void*  freelist_;
     size_t maxSize_; // 内存块的最大数目
     size_t size_;
+    size_t lowWater_; // 长度的最小值
+    size_t overages_; // 长度超过maxSize_的次数
 };
 
 /**
@@ -330,28 +470,36 @@ private:
 
 /**
  * @brief 管理以页为单位的大内存块
+ * @details 小块内存的大小记录在页映射中而不是Span中，按缓存行对齐，64位平台上恰好占用一个缓存行
  */
-struct Span {
+struct alignas(64) Span {
     Span()
         : pageId_(0)
         , cnt_(0)
         , next_(nullptr)
         , prev_(nullptr)
-        , useCnt_(0)
         , freelist_(nullptr)
+        , freeTime_(0)
+        , useCnt_(0)
         , used_(false)
-        , blockSize_(0) { }
-
-    page_t pageId_;    // 大块内存的起始页号
-    size_t cnt_;       // 页的数量
-    Span*  next_;      // 下一个大块内存
-    Span*  prev_;      // 上一个大块内存
-    size_t useCnt_;    // 切割为小块内存后，分配给ThreadCache的计数
-    void*  freelist_;  // 切割为小块内存后形成的自由链表
-    bool   used_;      // 是否正在被使用
-    size_t blockSize_; // 所切割的小内存块的大小
+        , released_(false)
+        , sampled_(false) { }
+
+    page_t               pageId_;   // 大块内存的起始页号
+    size_t               cnt_;      // 页的数量
+    Span*                next_;     // 下一个大块内存
+    Span*                prev_;     // 上一个大块内存
+    void*                freelist_; // 切割为小块内存后形成的自由链表
+    uint64_t             freeTime_; // 归还给PageCache的时间，单位为毫秒
+    uint32_t             useCnt_;   // 切割为小块内存后，分配给ThreadCache的计数
+    bool                 used_;     // 是否正在被使用
+    bool                 released_; // 空闲时其物理内存是否已归还给操作系统
+    bool                 sampled_;  // 是否由堆分析器单独分配给一个被采样的对象
+    std::atomic<uint8_t> shard_;    // 所属的PageCache分片，每次分配后写入；其它分片合并时会无锁读取，因此构造时不写入
 };
 
+static_assert(sizeof(void*) != 8 || sizeof(Span) == 64, "Span should fit in one cache line");
+
 /**
  * @brief 带有头节点的大内存块双向链表
  */
@@ -13,11 +13,16 @@ class Buffer {
 public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize  = 1024;
+    /// readFd所用线程局部临时缓冲区的大小
+    static const size_t kExtraBufSize = 65536;
+    /// readFd按待读取的字节数一次扩容的上限
+    static const size_t kMaxReadAhead = 256 * 1024;
 
     explicit Buffer(size_t initialSize = kInitialSize)
         : buffer_(kCheapPrepend + initialSize)
         , readerIndex_(kCheapPrepend)
-        , writerIndex_(kCheapPrepend) { }
+        , writerIndex_(kCheapPrepend)
+        , readHint_(kInitialSize) { }
     Buffer(const Buffer&) = default;
     Buffer& operator=(const Buffer&) = default;
     ~Buffer()                        = default;
@@ -43,6 +48,20 @@ public:
      */
     size_t prependabelBytes() const { return readerIndex_; }
 
+    /**
+     * @brief 返回缓冲区实际占用的字节数
+     * 
+     * @return size_t 
+     */
+    size_t internalCapacity() const { return buffer_.capacity(); }
+
+    /**
+     * @brief 返回最近几次readFd读取量的加权平均
+     * 
+     * @return size_t 
+     */
+    size_t readHint() const { return readHint_; }
+
     /**
      * @brief 返回缓冲区中可读数据的起始地址
      * 
@@ -102,6 +121,8 @@ public:
 
     /**
      * @brief 从fd中读取数据到缓冲区
+     * @details 剩余空间比最近的读取量少四分之一以上时，先通过FIONREAD查询待读取的字节数并扩容，使数据直接读入缓冲区；
+     * 超出剩余空间的数据先读入线程局部的临时缓冲区再追加。因此空闲连接的缓冲区可以很小
      * 
      * @param fd 文件描述符
      * @param saveErrno 传出参数，保存错误号
@@ -118,6 +139,13 @@ public:
      */
     ssize_t writeFd(int fd, int& saveErrno);
 
+    /**
+     * @brief 收缩缓冲区，只保留可读数据以及reserve字节的可写空间
+     * 
+     * @param reserve 保留的可写字节数
+     */
+    void shrink(size_t reserve);
+
     /**
      * @brief 与目标缓冲区进行交换
      * 
@@ -165,6 +193,7 @@ private:
     std::vector<char> buffer_;      // 动态缓冲区
     size_t            readerIndex_; // 读指针
     size_t            writerIndex_; // 写指针
+    size_t            readHint_;    // 最近几次readFd读取量的加权平均
 };
 } // namespace apollo
 
@@ -0,0 +1,140 @@
+#ifndef __APOLLO_CHAIN_BUFFER_H__
+#define __APOLLO_CHAIN_BUFFER_H__
+
+#include "typedpool.h"
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+namespace apollo {
+/**
+ * @brief 链式输出缓冲区
+ * @details 由若干节点组成的单向链表，每个节点或者持有一个定长的内存块，或者引用调用者持有的一段内存。
+ * 内存块和节点均由TypedPool分配，追加数据时只写入链表尾部的内存块，不会像连续的缓冲区那样扩容或搬移已有的数据；
+ * 读取时整块释放已读完的节点，写入fd时通过writev一次发送整条链表。
+ * 引用的外部内存不会被复制，其释放回调在数据被读完或缓冲区销毁时调用
+ */
+class ChainBuffer {
+public:
+    using ReleaseCallback = std::function<void()>;
+
+    /// 每个内存块的大小
+    static const size_t kBlockSize = 4096;
+    /// 一次writev最多发送的节点数
+    static const int kMaxIovecs = 64;
+    /// 小于该长度的外部内存直接复制，以免链表中出现大量零碎的节点
+    static const size_t kMinRefBytes = 1024;
+
+    ChainBuffer() = default;
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+    ~ChainBuffer() { retrieveAll(); }
+
+    /**
+     * @brief 返回可读的字节数
+     *
+     * @return size_t
+     */
+    size_t readableBytes() const { return readable_; }
+
+    /**
+     * @brief 返回持有的内存块占用的字节数，不包括引用的外部内存
+     *
+     * @return size_t
+     */
+    size_t allocatedBytes() const { return blocks_ * kBlockSize; }
+
+    /**
+     * @brief 读取长度为len的数据，释放已读完的节点
+     *
+     * @param len
+     */
+    void retrieve(size_t len);
+
+    /**
+     * @brief 释放所有节点
+     *
+     */
+    void retrieveAll();
+
+    /**
+     * @brief 向缓冲区中复制追加数据
+     *
+     * @param data 数据起始地址
+     * @param len 数据长度
+     */
+    void append(const char* data, size_t len);
+
+    /**
+     * @brief 向缓冲区中复制追加数据
+     *
+     * @param data
+     */
+    void append(const std::string& data) { append(data.data(), data.size()); }
+
+    /**
+     * @brief 以引用的方式追加调用者持有的数据
+     * @details 数据在release被调用之前须保持有效。长度小于kMinRefBytes时直接复制并立即调用release
+     *
+     * @param data 数据起始地址
+     * @param len 数据长度
+     * @param release 数据不再被引用时调用，可以为空
+     */
+    void appendRef(const void* data, size_t len, ReleaseCallback release);
+
+    /**
+     * @brief 将缓冲区中的可读数据写入到fd中，不移动读指针
+     *
+     * @param fd 文件描述符
+     * @param saveErrno 传出参数，保存错误号
+     * @return ssize_t 返回写入的数据长度
+     */
+    ssize_t writeFd(int fd, int& saveErrno);
+
+    /**
+     * @brief 与目标缓冲区进行交换
+     *
+     * @param rhs
+     */
+    void swap(ChainBuffer& rhs);
+
+private:
+    struct Block {
+        char data_[kBlockSize];
+    };
+
+    /**
+     * @brief 链表节点
+     * @details block_非空时[begin_, end_)位于内存块中，end_之后到内存块末尾为可写区域；
+     * 否则[begin_, end_)为引用的外部内存
+     */
+    struct Node : public PoolAllocated<Node> {
+        Node*           next_  = nullptr;
+        Block*          block_ = nullptr;
+        const char*     begin_ = nullptr;
+        const char*     end_   = nullptr;
+        ReleaseCallback release_;
+
+        size_t readable() const { return end_ - begin_; }
+        size_t writable() const { return block_ != nullptr ? block_->data_ + kBlockSize - end_ : 0; }
+    };
+
+    /**
+     * @brief 在链表尾部追加一个节点
+     */
+    void pushBack(Node* node);
+
+    /**
+     * @brief 删除链表头部的节点，归还其内存块或调用其释放回调
+     */
+    void popFront();
+
+private:
+    Node*  head_     = nullptr; // 链表头部，读取的位置
+    Node*  tail_     = nullptr; // 链表尾部，追加的位置
+    size_t readable_ = 0;       // 可读的字节数
+    size_t blocks_   = 0;       // 持有的内存块个数
+};
+} // namespace apollo
+
+#endif // __APOLLO_CHAIN_BUFFER_H__
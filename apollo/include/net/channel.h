@@ -2,6 +2,7 @@
 #define __APOLLO_CHANNEL_H__
 
 #include "timestamp.h"
+#include "typedpool.h"
 #include <functional>
 #include <memory>
 
@@ -14,7 +15,7 @@ class EventLoop;
  * @details 封装了sockfd和其感兴趣的event，例如EPOLLIN、EPOLLOUT事件
  * 还绑定了Poller返回的具体的事件
  */
-class Channel {
+class Channel : public PoolAllocated<Channel> {
 public:
     using ReadEventCallback = std::function<void(Timestamp)>;
     using EventCallback     = std::function<void()>;
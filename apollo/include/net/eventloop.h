@@ -3,12 +3,12 @@
 
 #include "callbacks.h"
 #include "common.h"
+#include "mpscqueue.h"
 #include "timerid.h"
 #include "timestamp.h"
 #include <atomic>
 #include <functional>
 #include <memory>
-#include <mutex>
 #include <vector>
 
 namespace apollo {
@@ -55,6 +55,8 @@ public:
 
     /**
      * @brief 缓存回调操作，唤醒loop所在的线程，执行回调操作
+     * @details 回调函数放入无锁队列，只有loop正阻塞在epoll_wait中时才写wakeupfd，
+     * 连续的多次调用至多唤醒一次
      * 
      * @param cb 要执行的回调函数
      */
@@ -145,9 +147,9 @@ private:
     std::atomic_bool looping_; // 是否正在事件循环
     std::atomic_bool quit_;    // 是否退出事件循环
 
-    std::atomic_bool     callingPendingFunctors_; // 当前loop是否正在执行回调操作
-    std::vector<Functor> pendingFunctors_;        // 当前事件循环需要执行的回调函数列表
-    std::mutex           mtx_;                    // 保护回调函数列表的线程安全
+    std::atomic_bool   callingPendingFunctors_; // 当前loop是否正在执行回调操作
+    std::atomic_bool   sleeping_;               // 当前loop是否即将或正在阻塞于epoll_wait
+    MpscQueue<Functor> pendingFunctors_;        // 当前事件循环需要执行的回调函数队列
 
     const pid_t threadId_; // 记录当前loop所在线程的ID
 
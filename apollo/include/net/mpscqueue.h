@@ -0,0 +1,101 @@
+#ifndef __APOLLO_MPSC_QUEUE_H__
+#define __APOLLO_MPSC_QUEUE_H__
+
+#include "typedpool.h"
+#include <atomic>
+#include <utility>
+
+namespace apollo {
+/**
+ * @brief 无锁的多生产者单消费者队列
+ * @details 以一个哑节点为头部的单向链表：生产者通过对tail_的原子交换占据队尾，再将前一个节点链接到新节点上，
+ * 因此入队只有一次原子交换，不会因竞争而重试；消费者只在所属的线程中从head_处出队，不需要任何同步。
+ * 生产者交换tail_后、链接前一个节点之前，消费者会暂时看不到该节点，此时队列并不为空但无法出队，
+ * 消费者需稍后重试。节点由TypedPool分配
+ */
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : head_(new Node)
+        , tail_(head_) { }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) { }
+        delete head_;
+    }
+
+    /**
+     * @brief 将数据放入队尾，可以在任意线程中调用
+     *
+     * @param value
+     */
+    void push(T value) {
+        Node* node   = new Node;
+        node->value_ = std::move(value);
+        Node* prev   = tail_.exchange(node, std::memory_order_seq_cst);
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief 从队头取出数据，只能在消费者线程中调用
+     *
+     * @param value 传出参数，保存取出的数据
+     * @return true 取出成功
+     * @return false 队列为空或者队头的节点尚未链接
+     */
+    bool pop(T& value) {
+        Node* next = head_->next_.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        // next成为新的哑节点 及时析构其中的数据
+        value        = std::move(next->value_);
+        next->value_ = T();
+        delete head_;
+        head_ = next;
+        return true;
+    }
+
+    /**
+     * @brief 依次取出调用时已入队的数据并交给func处理，只能在消费者线程中调用
+     * @details func中再次入队的数据留到下一次调用时处理，以免消费者一直无法返回
+     *
+     * @param func 处理函数，参数为T&&
+     * @return size_t 处理的数据个数
+     */
+    template <typename Func>
+    size_t consume(Func&& func) {
+        Node*  last  = tail_.load(std::memory_order_acquire);
+        size_t count = 0;
+        T      value;
+        while (head_ != last && pop(value)) {
+            func(std::move(value));
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 队列是否为空，只能在消费者线程中调用
+     * @details 以seq_cst读取tail_，调用者可以借此与生产者之间建立先后关系
+     */
+    bool empty() const { return tail_.load(std::memory_order_seq_cst) == head_; }
+
+private:
+    struct Node : public PoolAllocated<Node> {
+        std::atomic<Node*> next_ { nullptr };
+        T                  value_;
+    };
+
+    // 两者分处不同的缓存行 生产者与消费者互不干扰
+    alignas(64) Node*              head_; // 哑节点，只由消费者访问
+    alignas(64) std::atomic<Node*> tail_; // 最后一个入队的节点
+};
+} // namespace apollo
+
+#endif // !__APOLLO_MPSC_QUEUE_H__
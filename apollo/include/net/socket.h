@@ -1,6 +1,8 @@
 #ifndef __APOLLO_SOCKET_H__
 #define __APOLLO_SOCKET_H__
 
+#include "typedpool.h"
+
 namespace apollo {
 
 class InetAddress;
@@ -9,7 +11,7 @@ class InetAddress;
  * @brief 套接字封装类
  * 
  */
-class Socket {
+class Socket : public PoolAllocated<Socket> {
 public:
     explicit Socket(int sockfd)
         : sockfd_(sockfd) { }
@@ -3,11 +3,14 @@
 
 #include "buffer.h"
 #include "callbacks.h"
+#include "chainbuffer.h"
 #include "inetaddress.h"
 #include <atomic>
 #include <memory>
 #include <string>
+#include <vector>
 #include "timestamp.h"
+#include "typedpool.h"
 
 namespace apollo {
 
@@ -17,9 +20,9 @@ class Socket;
 
 /**
  * @brief TCP连接管理类
- * 
+ * @details 每个连接创建一次，由TypedPool分配以减少连接频繁建立和断开时的内存分配开销
  */
-class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
+class TcpConnection : public std::enable_shared_from_this<TcpConnection>, public PoolAllocated<TcpConnection> {
 public:
     /**
      * @brief Construct a new Tcp Connection object
@@ -72,17 +75,81 @@ public:
 
     /**
      * @brief 发送数据
+     * @details 在其它线程中调用时复制一份数据交给所属的事件循环
      * 
      * @param message 
      */
     void send(const std::string& message);
 
+    /**
+     * @brief 发送数据
+     * @details 数据被移动而不复制，较长的数据未能立即写入内核的部分以引用的方式留在输出缓冲区中，
+     * 发送完成后再释放
+     * 
+     * @param message 
+     */
+    void send(std::string&& message);
+
+    /**
+     * @brief 发送数据
+     * @details 在其它线程中调用时复制一份数据交给所属的事件循环
+     * 
+     * @param data 数据起始地址
+     * @param len 数据长度
+     */
+    void send(const void* data, size_t len);
+
+    /**
+     * @brief 发送缓冲区中的所有可读数据，调用后缓冲区被清空
+     * @details 在其它线程中调用时通过swap将缓冲区的内容交给所属的事件循环，不复制
+     * 
+     * @param buf 
+     */
+    void send(Buffer* buf);
+
+    /**
+     * @brief 依次发送多条数据
+     * @details 所有数据被移动到一个共享的vector中，在其它线程中调用时只投递一次任务。
+     * 整批数据追加到输出缓冲区后通过一次writev发送，发送完成时只调用一次消息发送完成的回调函数
+     * 
+     * @param messages 
+     */
+    void send(std::vector<std::string>&& messages);
+
+    /**
+     * @brief 发送调用者持有的数据，不复制
+     * @details 数据在release被调用之前须保持有效。未能立即写入内核的部分以引用的方式放入输出缓冲区，
+     * 发送完成或连接销毁后调用release；连接已断开时立即调用release
+     *
+     * @param data 数据起始地址
+     * @param len 数据长度
+     * @param release 数据不再被引用时调用，可以为空
+     */
+    void send(const void* data, size_t len, ChainBuffer::ReleaseCallback release);
+
     /**
      * @brief 关闭连接
      * 
      */
     void shutdown();
 
+    /**
+     * @brief 获取输入和输出缓冲区占用的字节数，须在所属的事件循环中调用
+     * 
+     * @return size_t 
+     */
+    size_t bufferBytes() const { return inputBuffer_.internalCapacity() + outputBuffer_.allocatedBytes(); }
+
+    /**
+     * @brief 释放空闲连接的输入缓冲区，须在所属的事件循环中调用
+     * @details 输入缓冲区为空且超过idleSeconds秒没有收到数据时生效。
+     * 输出缓冲区的内存块在数据发送完成后即被释放，无需处理
+     * 
+     * @param now 当前时间
+     * @param idleSeconds 空闲时间，单位为秒
+     */
+    void releaseIdleBuffers(Timestamp now, double idleSeconds);
+
     /**
      * @brief 设置新连接的回调函数
      * 
@@ -181,6 +248,23 @@ private:
      */
     void sendInLoop(const void* message, size_t len);
 
+    /**
+     * @brief 发送多条数据
+     * @details 较长的数据以引用的方式追加到输出缓冲区，由输出缓冲区中的节点共同持有messages
+     * 
+     * @param messages 
+     */
+    void sendBatchInLoop(const std::shared_ptr<std::vector<std::string>>& messages);
+
+    /**
+     * @brief 发送数据
+     * @details release为空时未发送的数据被复制到输出缓冲区，否则以引用的方式放入输出缓冲区
+     * @param message 消息首地址
+     * @param len 消息长度
+     * @param release 数据不再被引用时调用
+     */
+    void sendRefInLoop(const void* message, size_t len, const ChainBuffer::ReleaseCallback& release);
+
     /**
      * @brief 在事件循环中关闭连接
      * 
@@ -219,10 +303,11 @@ private:
     CloseCallback         closeCallback_;         // 连接关闭回调函数
     HighWaterMarkCallback highWaterMarkCallback_; // 高水位回调函数
 
-    size_t highWaterMark_; // 高水位线
+    size_t    highWaterMark_;   // 高水位线
+    Timestamp lastReceiveTime_; // 最近一次收到数据的时间
 
-    Buffer inputBuffer_;  // 输入缓冲区
-    Buffer outputBuffer_; // 输出缓冲区
+    Buffer      inputBuffer_;  // 输入缓冲区
+    ChainBuffer outputBuffer_; // 输出缓冲区
 };
 } // namespace apollo
 
@@ -82,6 +82,22 @@ public:
      */
     void setWriteCompleteCallback(const WriteCompleteCallback& cb) { writeCompleteCallback_ = cb; }
 
+    /**
+     * @brief 设置空闲连接释放输入缓冲区的超时时间
+     * @details 连接的输入缓冲区为空且超过seconds秒没有收到数据时释放其空间
+     * 
+     * @param seconds 超时时间，为0时不释放，默认为30秒
+     */
+    void setIdleBufferTimeout(double seconds) { idleBufferTimeout_ = seconds; }
+
+    /**
+     * @brief 获取所有连接的缓冲区占用的字节数
+     * @details 由定期的扫描统计，不是实时的数值
+     * 
+     * @return size_t 
+     */
+    size_t bufferBytes() const;
+
 private:
     /**
      * @brief 连接器接收到客户端连接后 将客户端连接打包成TcpConnection分发给SubLoop
@@ -105,6 +121,13 @@ private:
      */
     void removeConnectionInLoop(const TcpConnectionPtr& conn);
 
+    /**
+     * @brief 定期扫描所有连接，释放空闲连接的缓冲区并统计缓冲区占用的字节数
+     * @details 在MainLoop中按所属的SubLoop将连接分组，每个SubLoop只投递一个任务
+     * 
+     */
+    void scanBuffers();
+
 private:
     using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
 
@@ -125,6 +148,13 @@ private:
 
     int           nextConnId_;  // 下一个连接ID
     ConnectionMap connections_; // 保存所有客户端连接
+
+    using BufferBytes = std::vector<std::atomic<size_t>>;
+
+    double                       idleBufferTimeout_; // 空闲连接释放输入缓冲区的超时时间
+    TimerId                      bufferScanTimer_;   // 定期扫描缓冲区的定时器
+    std::vector<EventLoop*>      ioLoops_;           // 所有的SubLoop
+    std::shared_ptr<BufferBytes> bufferBytes_;       // 每个SubLoop中所有连接的缓冲区占用的字节数
 };
 } // namespace apollo
 
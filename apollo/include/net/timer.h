@@ -3,6 +3,7 @@
 
 #include "callbacks.h"
 #include "timestamp.h"
+#include "typedpool.h"
 #include <atomic>
 
 namespace apollo {
@@ -10,7 +11,7 @@ namespace apollo {
  * @brief 定时器
  * 
  */
-class Timer {
+class Timer : public PoolAllocated<Timer> {
 public:
     /**
      * @brief Construct a new Timer object
@@ -52,7 +52,7 @@ private:
 
     /**
      * @brief 序列化RPC的响应和网络发送
-     * 
+     * @details 发送后删除响应所在的Arena，释放本次调用的请求、响应和控制器
      */
     void sendRpcResponse(const TcpConnectionPtr&, google::protobuf::Message*);
 
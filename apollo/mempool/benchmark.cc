@@ -1,8 +1,15 @@
 #include "benchmark.h"
 #include "concurrentalloc.h"
 #include "utilis.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <thread>
 #include <vector>
 using namespace std;
@@ -87,3 +94,400 @@ void BenchmarkConcurrentMalloc(size_t ntimes, size_t nworks, size_t rounds) {
     cout << nworks << " 个线程并发执行 alloc&dealloc " << nworks * rounds * ntimes
          << " 次，共花费 " << ((double)malloc_costtime + (free_costtime)) / CLOCKS_PER_SEC << " s" << endl;
 }
+
+void BenchmarkSizeClass(size_t ntimes) {
+    // 累加结果防止查表被编译器优化掉
+    size_t sum   = 0;
+    auto   begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ntimes; i++) {
+        size_t bytes = (i * 2654435761u) % kMaxBytes + 1;
+        sum += AlignHelper::index(bytes) + AlignHelper::roundUp(bytes);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    cout << "映射字节数到哈希桶 " << ntimes << " 次，平均每次花费 " << ns / ntimes << " ns"
+         << " (校验值 " << sum % 10 << ")" << endl;
+}
+
+void BenchmarkThreadCache(size_t ntimes) {
+    // 每种大小先申请释放一次 使得之后的申请和释放都命中ThreadCache的自由链表
+    const size_t sizes[] = { 8, 16, 64, 128, 512, 1024, 4096, 8192 };
+    for (size_t size : sizes) {
+        concurrentFree(concurrentAlloc(size), size);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ntimes; i++) {
+        size_t size = sizes[i & 7];
+        void*  ptr  = concurrentAlloc(size);
+        concurrentFree(ptr, size);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    cout << "ThreadCache 申请并释放 " << ntimes << " 次，平均每次花费 " << ns / ntimes << " ns" << endl;
+}
+
+namespace {
+/// 每隔多少次操作记录一次耗时，避免计时本身拖慢吞吐量
+const size_t kLatencySample = 16;
+/// BenchmarkSizeMix中每个线程维持的存活对象个数
+const size_t kWorkingSet = 4096;
+
+/**
+ * @brief 对象大小的一个区间及其权重
+ */
+struct SizeBucket {
+    size_t   min_;
+    size_t   max_;
+    unsigned weight_;
+};
+
+/// 线上流量中对象大小的分布：protobuf的小消息和字符串居多，其次是Buffer的初始容量(8+1024)及其倍增，偶尔有大包
+const SizeBucket kSizeMix[] = {
+    { 16, 64, 40 },      { 65, 256, 25 },     { 257, 1024, 15 },      { 1032, 1032, 6 },
+    { 2064, 4128, 6 },   { 4129, 65536, 6 },  { 262145, 1048576, 2 },
+};
+
+inline void* benchAlloc(BenchAllocator allocator, size_t size) {
+    return allocator == BenchAllocator::APOLLO ? concurrentAlloc(size) : malloc(size);
+}
+
+inline void benchFree(BenchAllocator allocator, void* ptr, size_t size) {
+    if (allocator == BenchAllocator::APOLLO) {
+        concurrentFree(ptr, size);
+    } else {
+        free(ptr);
+    }
+}
+
+inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief 预先按照kSizeMix生成_n个对象大小，使随机数的开销不计入测试
+ */
+std::vector<size_t> makeSizeMix(size_t n, uint64_t seed) {
+    unsigned total = 0;
+    for (const SizeBucket& b : kSizeMix) {
+        total += b.weight_;
+    }
+    std::mt19937_64     rng(seed);
+    std::vector<size_t> sizes(n);
+    for (size_t i = 0; i < n; i++) {
+        unsigned pick = rng() % total;
+        for (const SizeBucket& b : kSizeMix) {
+            if (pick < b.weight_) {
+                sizes[i] = b.min_ + rng() % (b.max_ - b.min_ + 1);
+                break;
+            }
+            pick -= b.weight_;
+        }
+    }
+    return sizes;
+}
+
+/**
+ * @brief 读取/proc/self/status中以_key开头的一项，单位为字节
+ */
+size_t readStatus(const char* key) {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    char   line[256];
+    size_t kb  = 0;
+    size_t len = strlen(key);
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        if (strncmp(line, key, len) == 0) {
+            kb = strtoull(line + len, nullptr, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb * 1024;
+}
+
+/**
+ * @brief 记录测试开始时的驻留内存，并将驻留内存的峰值重置为当前值
+ */
+size_t resetPeakRss() {
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if (fp != nullptr) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+    return readStatus("VmRSS:");
+}
+
+/**
+ * @brief 一次计时本身的耗时，从记录的耗时中扣除
+ */
+double clockOverheadNs() {
+    static double overhead = []() {
+        std::vector<uint64_t> v(10000);
+        for (uint64_t& d : v) {
+            uint64_t begin = nowNs();
+            d              = nowNs() - begin;
+        }
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return static_cast<double>(v[v.size() / 2]);
+    }();
+    return overhead;
+}
+
+/**
+ * @brief 计算p50/p99/p999
+ */
+void percentiles(std::vector<uint32_t>& v, double out[3]) {
+    if (v.empty()) {
+        out[0] = out[1] = out[2] = 0;
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    const double ranks[] = { 0.5, 0.99, 0.999 };
+    for (int i = 0; i < 3; i++) {
+        size_t idx = std::min(v.size() - 1, static_cast<size_t>(v.size() * ranks[i]));
+        out[i]     = std::max(0.0, v[idx] - clockOverheadNs());
+    }
+}
+
+/**
+ * @brief 收集各个线程的耗时样本与存活字节数，并计算最终的测试结果
+ */
+class BenchRecorder {
+public:
+    BenchRecorder() { startRss_ = resetPeakRss(); }
+
+    /**
+     * @brief 线程结束时合并其样本
+     */
+    void merge(const std::vector<uint32_t>& allocs, const std::vector<uint32_t>& frees, size_t peakLive) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        allocNs_.insert(allocNs_.end(), allocs.begin(), allocs.end());
+        freeNs_.insert(freeNs_.end(), frees.begin(), frees.end());
+        peakLive_ += peakLive;
+    }
+
+    BenchResult finish(size_t totalOps, uint64_t elapsedNs) {
+        BenchResult result;
+        size_t      peak     = readStatus("VmHWM:");
+        result.opsPerSec     = totalOps * 1e9 / std::max<uint64_t>(elapsedNs, 1);
+        result.peakRssBytes  = peak > startRss_ ? peak - startRss_ : 0;
+        result.peakLiveBytes = peakLive_;
+        percentiles(allocNs_, result.allocNs);
+        percentiles(freeNs_, result.freeNs);
+        return result;
+    }
+
+private:
+    std::mutex            mtx_;
+    std::vector<uint32_t> allocNs_;
+    std::vector<uint32_t> freeNs_;
+    size_t                startRss_;
+    size_t                peakLive_ = 0; // 各线程存活字节数峰值之和，是整体峰值的上界
+};
+
+/**
+ * @brief 单生产者单消费者的无锁环形队列
+ */
+class PtrRing {
+public:
+    bool push(void* ptr, size_t size) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+            return false;
+        }
+        slots_[tail % kCapacity] = { ptr, size };
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(void*& ptr, size_t& size) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        ptr  = slots_[head % kCapacity].first;
+        size = slots_[head % kCapacity].second;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static const size_t kCapacity = 4096;
+
+    alignas(64) std::atomic<size_t> head_ { 0 };
+    alignas(64) std::atomic<size_t> tail_ { 0 };
+    std::pair<void*, size_t> slots_[kCapacity];
+};
+} // namespace
+
+BenchResult BenchmarkSizeMix(BenchAllocator allocator, size_t nops, size_t nworks) {
+    BenchRecorder            recorder;
+    std::vector<std::thread> vthread(nworks);
+    uint64_t                 begin = nowNs();
+    for (size_t k = 0; k < nworks; ++k) {
+        vthread[k] = std::thread([&, k]() {
+            std::vector<size_t>                  sizes = makeSizeMix(nops, k + 1);
+            std::vector<std::pair<void*, size_t>> live(kWorkingSet, { nullptr, 0 });
+            std::vector<uint32_t>                allocs, frees;
+            allocs.reserve(nops / kLatencySample + 1);
+            frees.reserve(nops / kLatencySample + 1);
+            size_t liveBytes = 0, peakLive = 0;
+
+            for (size_t i = 0; i < nops; i++) {
+                std::pair<void*, size_t>& slot   = live[i % kWorkingSet];
+                bool                      sample = i % kLatencySample == 0;
+                if (slot.first != nullptr) {
+                    uint64_t t = sample ? nowNs() : 0;
+                    benchFree(allocator, slot.first, slot.second);
+                    if (sample) {
+                        frees.push_back(static_cast<uint32_t>(nowNs() - t));
+                    }
+                    liveBytes -= slot.second;
+                }
+                uint64_t t    = sample ? nowNs() : 0;
+                void*    ptr  = benchAlloc(allocator, sizes[i]);
+                if (sample) {
+                    allocs.push_back(static_cast<uint32_t>(nowNs() - t));
+                }
+                // 写入首字节 使对象真正占用物理内存
+                *static_cast<char*>(ptr) = 1;
+                slot                     = { ptr, sizes[i] };
+                liveBytes += sizes[i];
+                peakLive = std::max(peakLive, liveBytes);
+            }
+            for (auto& slot : live) {
+                if (slot.first != nullptr) {
+                    benchFree(allocator, slot.first, slot.second);
+                }
+            }
+            recorder.merge(allocs, frees, peakLive);
+        });
+    }
+    for (auto& t : vthread) {
+        t.join();
+    }
+    return recorder.finish(2 * nops * nworks, nowNs() - begin);
+}
+
+BenchResult BenchmarkProducerConsumer(BenchAllocator allocator, size_t nops, size_t npairs) {
+    BenchRecorder            recorder;
+    std::vector<PtrRing>     rings(npairs);
+    std::vector<std::thread> vthread;
+    std::atomic<size_t>      freedBytes { 0 }; // 消费者每释放一批对象累加一次
+    uint64_t                 begin = nowNs();
+    for (size_t k = 0; k < npairs; ++k) {
+        // 生产者
+        vthread.emplace_back([&, k]() {
+            std::vector<size_t>   sizes = makeSizeMix(nops, k + 1);
+            std::vector<uint32_t> allocs;
+            allocs.reserve(nops / kLatencySample + 1);
+            size_t allocBytes = 0, peakLive = 0;
+            for (size_t i = 0; i < nops; i++) {
+                bool     sample = i % kLatencySample == 0;
+                uint64_t t      = sample ? nowNs() : 0;
+                void*    ptr    = benchAlloc(allocator, sizes[i]);
+                if (sample) {
+                    allocs.push_back(static_cast<uint32_t>(nowNs() - t));
+                }
+                *static_cast<char*>(ptr) = 1;
+                allocBytes += sizes[i];
+                if (sample) {
+                    // 其它生产者的对象也计入了freedBytes 只是近似值
+                    size_t freed = freedBytes.load(std::memory_order_relaxed);
+                    peakLive     = std::max(peakLive, allocBytes > freed ? allocBytes - freed : 0);
+                }
+                while (!rings[k].push(ptr, sizes[i])) {
+                    std::this_thread::yield();
+                }
+            }
+            recorder.merge(allocs, {}, peakLive);
+        });
+        // 消费者
+        vthread.emplace_back([&, k]() {
+            std::vector<uint32_t> frees;
+            frees.reserve(nops / kLatencySample + 1);
+            size_t batchBytes = 0;
+            for (size_t i = 0; i < nops; i++) {
+                void*  ptr  = nullptr;
+                size_t size = 0;
+                while (!rings[k].pop(ptr, size)) {
+                    std::this_thread::yield();
+                }
+                bool     sample = i % kLatencySample == 0;
+                uint64_t t      = sample ? nowNs() : 0;
+                benchFree(allocator, ptr, size);
+                if (sample) {
+                    frees.push_back(static_cast<uint32_t>(nowNs() - t));
+                    freedBytes.fetch_add(batchBytes, std::memory_order_relaxed);
+                    batchBytes = 0;
+                }
+                batchBytes += size;
+            }
+            freedBytes.fetch_add(batchBytes, std::memory_order_relaxed);
+            recorder.merge({}, frees, 0);
+        });
+    }
+    for (auto& t : vthread) {
+        t.join();
+    }
+    return recorder.finish(2 * nops * npairs, nowNs() - begin);
+}
+
+BenchResult BenchmarkLargeAlloc(BenchAllocator allocator, size_t nops, size_t nworks) {
+    const size_t             kLargeWorkingSet = 8;
+    BenchRecorder            recorder;
+    std::vector<std::thread> vthread(nworks);
+    uint64_t                 begin = nowNs();
+    for (size_t k = 0; k < nworks; ++k) {
+        vthread[k] = std::thread([&, k]() {
+            std::mt19937_64                       rng(k + 1);
+            std::vector<std::pair<void*, size_t>> live(kLargeWorkingSet, { nullptr, 0 });
+            std::vector<uint32_t>                 allocs, frees;
+            size_t                                liveBytes = 0, peakLive = 0;
+            for (size_t i = 0; i < nops; i++) {
+                std::pair<void*, size_t>& slot = live[i % kLargeWorkingSet];
+                if (slot.first != nullptr) {
+                    uint64_t t = nowNs();
+                    benchFree(allocator, slot.first, slot.second);
+                    frees.push_back(static_cast<uint32_t>(nowNs() - t));
+                    liveBytes -= slot.second;
+                }
+                size_t   size = kMaxBytes + 1 + rng() % (4 * 1024 * 1024 - kMaxBytes);
+                uint64_t t    = nowNs();
+                char*    ptr  = static_cast<char*>(benchAlloc(allocator, size));
+                allocs.push_back(static_cast<uint32_t>(nowNs() - t));
+                // 每页写入一个字节
+                for (size_t off = 0; off < size; off += 4096) {
+                    ptr[off] = 1;
+                }
+                slot = { ptr, size };
+                liveBytes += size;
+                peakLive = std::max(peakLive, liveBytes);
+            }
+            for (auto& slot : live) {
+                if (slot.first != nullptr) {
+                    benchFree(allocator, slot.first, slot.second);
+                }
+            }
+            recorder.merge(allocs, frees, peakLive);
+        });
+    }
+    for (auto& t : vthread) {
+        t.join();
+    }
+    return recorder.finish(2 * nops * nworks, nowNs() - begin);
+}
+
+void PrintBenchResult(const char* name, BenchAllocator allocator, size_t nworks, const BenchResult& result) {
+    printf("%-18s %-6s %2zu 线程 %11.0f ops/s | alloc p50/p99/p999 %6.0f %7.0f %8.0f ns"
+           " | free p50/p99/p999 %6.0f %7.0f %8.0f ns | RSS 峰值 %8.1f MiB 存活峰值 %8.1f MiB\n",
+           name, allocator == BenchAllocator::APOLLO ? "apollo" : "malloc", nworks, result.opsPerSec,
+           result.allocNs[0], result.allocNs[1], result.allocNs[2], result.freeNs[0], result.freeNs[1], result.freeNs[2],
+           result.peakRssBytes / 1048576.0, result.peakLiveBytes / 1048576.0);
+}
@@ -1,9 +1,33 @@
 #include "centralcache.h"
+#include "mallocstats.h"
 #include "pagecache.h"
 using namespace apollo;
 
-size_t CentralCache::fetchRangeObj(void*& start, void*& end, size_t cnt, size_t size) {
-    size_t                       index = AlignHelper::index(size);
+/**
+ * @brief 为依次构造的CentralCache分配所属的NUMA节点
+ */
+static size_t nextNode() {
+    static size_t nodes = 0;
+    return nodes++;
+}
+
+CentralCache::CentralCache()
+    : node_(nextNode()) {
+    // 按照每个哈希桶的对象大小设置TransferCache的容量
+    for (size_t i = 0; i < kBucketSize; i++) {
+        transfers_[i].init(AlignHelper::classSize(i));
+    }
+}
+
+size_t CentralCache::fetchRangeObj(void*& start, void*& end, size_t cnt, size_t size, uint16_t origin) {
+    size_t index = AlignHelper::index(size);
+
+    // 优先从TransferCache中整批获取 无需访问Span
+    size_t actualnum = transfers_[index].removeRange(start, end, cnt);
+    if (actualnum > 0) {
+        return actualnum;
+    }
+
     std::unique_lock<std::mutex> lock(spanlists_[index].mtx_); // 加锁
 
     // 在对应的哈希桶中获取一个非空的span
@@ -13,11 +37,19 @@ size_t CentralCache::fetchRangeObj(void*& start, void*& end, size_t cnt, size_t
     assert(span && span->freelist_);
 
     // 从span中获取n个对象 如果不够n个，有多少拿多少
-    start           = span->freelist_;
-    end             = span->freelist_;
-    size_t actualnum = 1;
+    // 同时在对象所在的页上记录获取者 其它线程释放这些对象时据此将其送回
+    PageCache* pages = PageCache::getInstance();
+    start            = span->freelist_;
+    end              = span->freelist_;
+    actualnum        = 1;
+    page_t page      = (page_t)start >> kPageShift;
+    pages->setOrigin(start, origin);
     while (nextObj(end) && (cnt - 1)) {
         end = nextObj(end);
+        if (((page_t)end >> kPageShift) != page) {
+            page = (page_t)end >> kPageShift;
+            pages->setOrigin(end, origin);
+        }
         actualnum++;
         cnt--;
     }
@@ -28,6 +60,35 @@ size_t CentralCache::fetchRangeObj(void*& start, void*& end, size_t cnt, size_t
     return actualnum;
 }
 
+void CentralCache::insertRange(void* start, void* end, size_t cnt, size_t size) {
+    size_t index = AlignHelper::index(size);
+    if (!transfers_[index].insertRange(start, end, cnt)) {
+        releaseList(start, size);
+    }
+}
+
+void CentralCache::collectStats(MallocStats& stats) {
+    for (size_t i = 0; i < kBucketSize; i++) {
+        SizeClassStats& cls  = stats.classes_[i];
+        size_t          size = AlignHelper::classSize(i);
+        {
+            std::lock_guard<std::mutex> lock(spanlists_[i].mtx_);
+            for (Span* span = spanlists_[i].begin(); span != spanlists_[i].end(); span = span->next_) {
+                // span切分出的对象个数与getOneSpan中一致
+                size_t capacity = (span->cnt_ << kPageShift) / size;
+                cls.spans_++;
+                cls.centralCacheBytes_ += (capacity - span->useCnt_) * size;
+                cls.inUseBytes_ += span->useCnt_ * size;
+                stats.centralCacheBytes_ += (capacity - span->useCnt_) * size;
+            }
+        }
+        // 开启APLNUMA选项时有多个CentralCache 这里需要累加
+        size_t transfer = transfers_[i].objects() * size;
+        cls.transferCacheBytes_ += transfer;
+        stats.transferCacheBytes_ += transfer;
+    }
+}
+
 void CentralCache::releaseList(void* start, size_t size) {
     size_t index = AlignHelper::index(size);
 
@@ -48,11 +109,12 @@ void CentralCache::releaseList(void* start, size_t size) {
             span->freelist_ = nullptr; // 自由链表置空
             span->next_     = nullptr;
             span->prev_     = nullptr;
+            PageCache::getInstance()->setSizeClass(span, 0);
 
             // 释放span给PageCache时，使用PageCache的锁就可以了，这时把桶锁解掉
             bucket_lock.unlock(); // 解桶锁
             {
-                PageCache*                  cache = PageCache::getInstance();
+                PageCache*                  cache = PageCache::ownerOf(span);
                 std::lock_guard<std::mutex> lock(cache->mtx_);
                 cache->revertSpanToPageCache(span);
             }
@@ -79,14 +141,17 @@ Span* CentralCache::getOneSpan(SpanList& list, size_t size, std::unique_lock<std
 
     Span* span = nullptr;
     {
-        std::lock_guard<std::mutex> lock(PageCache::getInstance()->mtx_);
+        // 不同大小的对象从本节点不同的分片中申请span
+        PageCache*                  cache = PageCache::getInstance(PageCache::shardOf(size, node_));
+        std::lock_guard<std::mutex> lock(cache->mtx_);
 
         // 如果_list中没有非空的span，只能向PageCache申请
-        span             = PageCache::getInstance()->newSpan(AlignHelper::numMovePage(size));
-        span->used_      = true;
-        span->blockSize_ = size;
+        span        = cache->newSpan(AlignHelper::numMovePage(size));
+        span->used_ = true;
     }
     assert(span);
+    // 在对象被分配出去之前记录 释放时据此确定对象的大小
+    PageCache::getInstance()->setSizeClass(span, AlignHelper::index(size) + 1);
 
     // 计算span的大块内存的起始地址和大块内存的大小（字节数）
     char*  start = (char*)(span->pageId_ << kPageShift);
@@ -98,8 +163,8 @@ Span* CentralCache::getOneSpan(SpanList& list, size_t size, std::unique_lock<std
     span->freelist_ = start;
     start += size;
     void* tail = span->freelist_;
-    // 尾插
-    while (start < end) {
+    // 尾插 最后不足一个对象大小的内存不再切分
+    while (start + size <= end) {
         nextObj(tail) = start;
         tail          = nextObj(tail);
         start += size;
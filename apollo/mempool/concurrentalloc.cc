@@ -32,3 +32,91 @@ void operator delete[](void* ptr) noexcept {
     return free(ptr);
 #endif
 }
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* ptr, size_t size) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFree(ptr, size);
+#else
+    (void)size;
+    return free(ptr);
+#endif
+}
+
+void operator delete[](void* ptr, size_t size) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFree(ptr, size);
+#else
+    (void)size;
+    return free(ptr);
+#endif
+}
+#endif
+
+#ifdef __cpp_aligned_new
+#ifndef TCMALLOC
+/**
+ * @brief 使用系统的分配器申请对齐的内存
+ */
+static void* systemAlignedAlloc(size_t size, std::align_val_t align) {
+    size_t alignment = std::max(static_cast<size_t>(align), sizeof(void*));
+    void*  ptr       = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+#endif
+
+void* operator new(size_t size, std::align_val_t align) {
+#ifdef TCMALLOC
+    return apollo::concurrentAllocAligned(size, static_cast<size_t>(align));
+#else
+    return systemAlignedAlloc(size, align);
+#endif
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+#ifdef TCMALLOC
+    return apollo::concurrentAllocAligned(size, static_cast<size_t>(align));
+#else
+    return systemAlignedAlloc(size, align);
+#endif
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFree(ptr);
+#else
+    return free(ptr);
+#endif
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFree(ptr);
+#else
+    return free(ptr);
+#endif
+}
+
+void operator delete(void* ptr, size_t size, std::align_val_t align) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFreeAligned(ptr, size, static_cast<size_t>(align));
+#else
+    (void)size;
+    (void)align;
+    return free(ptr);
+#endif
+}
+
+void operator delete[](void* ptr, size_t size, std::align_val_t align) noexcept {
+#ifdef TCMALLOC
+    return apollo::concurrentFreeAligned(ptr, size, static_cast<size_t>(align));
+#else
+    (void)size;
+    (void)align;
+    return free(ptr);
+#endif
+}
+#endif
@@ -0,0 +1,92 @@
+#include "cpucache.h"
+#include "mallocstats.h"
+#include "numa.h"
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
+#endif
+#endif
+using namespace apollo;
+
+/**
+ * @brief 获取当前线程所在的CPU编号，获取失败时返回-1
+ */
+static int currentCpu() {
+#ifdef RSEQ_SIG
+    // glibc 2.35及以上版本会为每个线程注册rseq 内核在调度时更新其中的cpu_id
+    if (__rseq_size > 0) {
+        const struct rseq* rs = reinterpret_cast<const struct rseq*>(
+            static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+        int cpu = static_cast<int>(__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED));
+        if (cpu >= 0) {
+            return cpu;
+        }
+    }
+#endif
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+CpuCache::CpuCache()
+    : slots_(nullptr)
+    , nslots_(1) {
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu > 1) {
+        nslots_ = static_cast<size_t>(ncpu);
+    }
+#endif
+    // 槽位数组不能从内存池本身申请 直接映射整数页
+    size_t bytes = sizeof(Slot) * nslots_;
+    size_t npage = (bytes + (1 << kPageShift) - 1) >> kPageShift;
+    slots_       = static_cast<Slot*>(systemAlloc(npage));
+    for (size_t i = 0; i < nslots_; i++) {
+        new (&slots_[i]) Slot;
+        slots_[i].cache_.bindNode(NumaHelper::nodeOfCpu(i));
+        // 槽位的容量同样计入所有ThreadCache的总容量 并可以互相窃取
+        ThreadCache::registerCache(&slots_[i].cache_);
+    }
+}
+
+void* CpuCache::allocate(size_t size) {
+    Slot&                     slot = slots_[currentSlot()];
+    std::lock_guard<SpinLock> lock(slot.lock_);
+    return slot.cache_.allocate(size);
+}
+
+void CpuCache::deallocate(void* ptr, size_t size) {
+    Slot&                     slot = slots_[currentSlot()];
+    std::lock_guard<SpinLock> lock(slot.lock_);
+    slot.cache_.deallocate(ptr, size);
+}
+
+bool CpuCache::deallocate(void* ptr, size_t size, size_t node) {
+    Slot&                     slot = slots_[currentSlot()];
+    std::lock_guard<SpinLock> lock(slot.lock_);
+    if (slot.cache_.node() != node) {
+        return false;
+    }
+    slot.cache_.deallocate(ptr, size);
+    return true;
+}
+
+void CpuCache::collectStats(MallocStats& stats) {
+    // 槽位与线程共用同一个总容量 须在获取槽位的锁之前读取
+    stats.threadCacheLimit_ = ThreadCache::overallCacheSize();
+    for (size_t i = 0; i < nslots_; i++) {
+        std::lock_guard<SpinLock> lock(slots_[i].lock_);
+        slots_[i].cache_.addStats(stats);
+    }
+}
+
+size_t CpuCache::currentSlot() const {
+    int cpu = currentCpu();
+    return cpu < 0 ? 0 : static_cast<size_t>(cpu) % nslots_;
+}
@@ -0,0 +1,289 @@
+#include "heapprofiler.h"
+#include "common.h"
+#include "configparser.h"
+#include "numa.h"
+#include "pagecache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#ifdef __linux__
+#include <execinfo.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+using namespace apollo;
+
+/// 调用栈的最大深度
+static const int kMaxStackDepth = 32;
+/// 未开启采样时每申请多少字节检查一次是否开启了采样
+static const int64_t kDisabledInterval = 16 * 1024 * 1024;
+/// 采样记录哈希表的桶数
+static const size_t kSampleBuckets = 4096;
+
+/**
+ * @brief 一个仍存活的采样对象
+ */
+struct HeapSample {
+    void*       ptr_;                   // 对象的地址
+    size_t      size_;                  // 申请的字节数
+    int         depth_;                 // 调用栈的深度
+    void*       stack_[kMaxStackDepth]; // 申请时的调用栈
+    HeapSample* next_;                  // 哈希桶中的下一个记录
+};
+
+TLS int64_t         HeapProfiler::tlsBytesUntilSample_ = 0;
+std::atomic<size_t> HeapProfiler::liveSamples_ { 0 };
+
+static TLS uint64_t        tlsRandom   = 0;     // 线程局部的随机数状态
+static TLS bool            tlsSampling = false; // 防止记录调用栈时的内存申请再次被采样
+static std::atomic<size_t> s_sampleRate { 0 };  // 采样的平均间隔
+
+// 以下变量均由s_samplemtx保护
+static std::mutex             s_samplemtx;
+static ObjectPool<HeapSample> s_samplepool;
+static HeapSample*            s_samples[kSampleBuckets] = { nullptr };
+
+// 以下变量由dumpOnSignal初始化 之后只由输出线程访问
+static std::mutex s_dumpmtx;
+static bool       s_dumpStarted     = false;
+static char       s_dumpPrefix[256] = { 0 };
+static size_t     s_dumpCount       = 0;
+#ifdef __linux__
+static sem_t s_dumpSem; // 信号处理函数通过它唤醒输出线程
+#endif
+
+static size_t bucketOf(const void* ptr) {
+    // 采样对象的地址按页对齐 舍去页内偏移
+    return ((uintptr_t)ptr >> kPageShift) % kSampleBuckets;
+}
+
+/**
+ * @brief 生成下一次采样前需要申请的字节数，服从均值为_rate的指数分布
+ */
+static int64_t nextSampleInterval(size_t rate) {
+    if (tlsRandom == 0) {
+        tlsRandom = (uintptr_t)&tlsRandom ^ 0x9E3779B97F4A7C15ULL;
+    }
+    // xorshift64*
+    tlsRandom ^= tlsRandom >> 12;
+    tlsRandom ^= tlsRandom << 25;
+    tlsRandom ^= tlsRandom >> 27;
+    uint64_t r = tlsRandom * 0x2545F4914F6CDD1DULL;
+
+    // 取53位得到(0, 1]之间的均匀分布
+    double u        = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double interval = -std::log(u) * static_cast<double>(rate);
+    return static_cast<int64_t>(std::min(interval, 4e18)) + 1;
+}
+
+void HeapProfiler::setSampleRate(size_t rate) {
+#ifdef __linux__
+    // backtrace第一次调用时会加载libgcc并申请内存 提前调用一次
+    if (rate > 0) {
+        void* stack[1];
+        backtrace(stack, 1);
+    }
+#endif
+    s_sampleRate.store(rate, std::memory_order_relaxed);
+}
+
+size_t HeapProfiler::sampleRate() {
+    return s_sampleRate.load(std::memory_order_relaxed);
+}
+
+void HeapProfiler::start() {
+    auto config = ConfigParser::getInstance()->mempoolConfig();
+    if (config.heapSampleRate == 0) {
+        return;
+    }
+    setSampleRate(config.heapSampleRate);
+#ifdef __linux__
+    dumpOnSignal(SIGUSR2, config.heapProfile.c_str());
+#endif
+}
+
+void* HeapProfiler::sampledAlloc(size_t size) {
+    size_t rate = s_sampleRate.load(std::memory_order_relaxed);
+    if (rate == 0 || tlsSampling) {
+        tlsBytesUntilSample_ = rate == 0 ? kDisabledInterval : nextSampleInterval(rate);
+        return nullptr;
+    }
+    tlsBytesUntilSample_ = nextSampleInterval(rate);
+    tlsSampling          = true;
+
+    HeapSample* sample = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(s_samplemtx);
+        sample = s_samplepool.alloc();
+    }
+#ifdef __linux__
+    sample->depth_ = backtrace(sample->stack_, kMaxStackDepth);
+#else
+    sample->depth_ = 0;
+#endif
+
+    // 被采样的对象单独占用若干页 释放时可以通过Span上的标记识别
+    size_t npage = (size + (1 << kPageShift) - 1) >> kPageShift;
+    Span*  span  = nullptr;
+    {
+        PageCache* cache = PageCache::getInstance(PageCache::shardOf(npage << kPageShift, NumaHelper::currentNode()));
+        std::lock_guard<std::mutex> lock(cache->mtx_);
+        span           = cache->newSpan(npage);
+        span->used_    = true;
+        span->sampled_ = true;
+        cache->addLargeSpan(span);
+    }
+
+    void* ptr     = (void*)(span->pageId_ << kPageShift);
+    sample->ptr_  = ptr;
+    sample->size_ = size;
+    {
+        std::lock_guard<std::mutex> lock(s_samplemtx);
+        HeapSample*& head = s_samples[bucketOf(ptr)];
+        sample->next_     = head;
+        head              = sample;
+    }
+    liveSamples_.fetch_add(1, std::memory_order_relaxed);
+
+    tlsSampling = false;
+    return ptr;
+}
+
+void HeapProfiler::sampledFree(void* ptr, Span* span) {
+    assert(span->sampled_);
+    {
+        std::lock_guard<std::mutex> lock(s_samplemtx);
+        for (HeapSample** cur = &s_samples[bucketOf(ptr)]; *cur != nullptr; cur = &(*cur)->next_) {
+            if ((*cur)->ptr_ == ptr) {
+                HeapSample* sample = *cur;
+                *cur               = sample->next_;
+                s_samplepool.free(sample);
+                break;
+            }
+        }
+    }
+    liveSamples_.fetch_sub(1, std::memory_order_relaxed);
+
+    PageCache*                  cache = PageCache::ownerOf(span);
+    std::lock_guard<std::mutex> lock(cache->mtx_);
+    span->sampled_ = false;
+    cache->removeLargeSpan(span);
+    cache->revertSpanToPageCache(span);
+}
+
+#ifdef __linux__
+/**
+ * @brief 将_len字节完整地写入文件
+ */
+static void writeAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+bool HeapProfiler::dump(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // 输出过程中不申请内存 每个采样对象单独一行 由pprof按调用栈合并
+    char                        buf[64 + kMaxStackDepth * 20];
+    std::lock_guard<std::mutex> lock(s_samplemtx);
+    size_t                      objects = 0, bytes = 0;
+    for (size_t i = 0; i < kSampleBuckets; i++) {
+        for (HeapSample* sample = s_samples[i]; sample != nullptr; sample = sample->next_) {
+            objects++;
+            bytes += sample->size_;
+        }
+    }
+    int len = snprintf(buf, sizeof(buf), "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n", objects, bytes, objects,
+                       bytes, sampleRate());
+    writeAll(fd, buf, len);
+
+    for (size_t i = 0; i < kSampleBuckets; i++) {
+        for (HeapSample* sample = s_samples[i]; sample != nullptr; sample = sample->next_) {
+            len = snprintf(buf, sizeof(buf), "%6d: %8zu [%6d: %8zu] @", 1, sample->size_, 1, sample->size_);
+            for (int d = 0; d < sample->depth_; d++) {
+                len += snprintf(buf + len, sizeof(buf) - len, " %p", sample->stack_[d]);
+            }
+            buf[len++] = '\n';
+            writeAll(fd, buf, len);
+        }
+    }
+
+    // pprof依据内存映射将地址还原为符号
+    writeAll(fd, "\nMAPPED_LIBRARIES:\n", 19);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        ssize_t n = 0;
+        while ((n = read(maps, buf, sizeof(buf))) > 0) {
+            writeAll(fd, buf, n);
+        }
+        close(maps);
+    }
+    close(fd);
+    return true;
+}
+
+static void dumpSignalHandler(int) {
+    // sem_post可以在信号处理函数中安全调用
+    sem_post(&s_dumpSem);
+}
+
+/**
+ * @brief 堆分析文件输出线程的执行函数，每收到一次信号输出一份文件
+ */
+static void dumpThreadFunc() {
+    while (true) {
+        if (sem_wait(&s_dumpSem) != 0) {
+            continue;
+        }
+        char path[sizeof(s_dumpPrefix) + 16];
+        snprintf(path, sizeof(path), "%s.%04zu.heap", s_dumpPrefix, ++s_dumpCount);
+        HeapProfiler::dump(path);
+    }
+}
+
+void HeapProfiler::dumpOnSignal(int signo, const char* prefix) {
+    std::lock_guard<std::mutex> lock(s_dumpmtx);
+    if (s_dumpStarted) {
+        return;
+    }
+    s_dumpStarted = true;
+    snprintf(s_dumpPrefix, sizeof(s_dumpPrefix), "%s", prefix);
+    sem_init(&s_dumpSem, 0, 0);
+
+    // 输出线程与空闲页回收线程相互独立 不依赖回收线程是否启动
+    std::thread thread(dumpThreadFunc);
+    ThreadHelper::SetThreadName(&thread, "heapdump");
+    thread.detach();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dumpSignalHandler;
+    sa.sa_flags   = SA_RESTART;
+    sigaction(signo, &sa, nullptr);
+}
+#else
+bool HeapProfiler::dump(const char*) {
+    return false;
+}
+
+void HeapProfiler::dumpOnSignal(int, const char*) { }
+#endif
+
+#ifdef TCMALLOC
+// 加载时按照配置开启采样 不依赖TcpServer或回收线程的启动
+static const bool s_profilerStarted = (HeapProfiler::start(), true);
+#endif
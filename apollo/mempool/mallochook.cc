@@ -0,0 +1,145 @@
+#if defined(TCMALLOC) && defined(APLOVERRIDEMALLOC)
+#include "concurrentalloc.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <unistd.h>
+using namespace apollo;
+
+/**
+ * 替换glibc的malloc系列函数，使C代码(protobuf内部、zookeeper、libc自身等)申请的内存也经由内存池分配，
+ * 进程中不再同时存在两个堆。glibc会将其内部对这些函数的调用转发到这里，因此必须全部替换，
+ * 否则由glibc的memalign等函数申请的内存会被这里的free释放。
+ * 这些函数不能抛出异常，内存不足时设置errno为ENOMEM并返回空指针
+ */
+
+/**
+ * @brief 申请内存，失败时返回空指针
+ */
+static void* hookAlloc(size_t size) {
+    if (size > PTRDIFF_MAX) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    try {
+        return concurrentAlloc(size);
+    } catch (const std::bad_alloc&) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 申请对齐的内存，_align不是2的整数次幂时返回空指针并设置errno为EINVAL
+ */
+static void* hookAllocAligned(size_t align, size_t size) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    if (size > PTRDIFF_MAX) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    try {
+        return concurrentAllocAligned(size, std::max(align, sizeof(void*)));
+    } catch (const std::bad_alloc&) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+extern "C" {
+void* malloc(size_t size) noexcept {
+    return hookAlloc(size);
+}
+
+void free(void* ptr) noexcept {
+    concurrentFree(ptr);
+}
+
+void* calloc(size_t nmemb, size_t size) noexcept {
+    size_t bytes = 0;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void* ptr = hookAlloc(bytes);
+    if (ptr != nullptr) {
+        memset(ptr, 0, bytes);
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+    if (size > PTRDIFF_MAX) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    try {
+        return concurrentRealloc(ptr, size);
+    } catch (const std::bad_alloc&) {
+        // 原有的内存保持不变
+        errno = ENOMEM;
+        return nullptr;
+    }
+}
+
+void* reallocarray(void* ptr, size_t nmemb, size_t size) noexcept {
+    size_t bytes = 0;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, bytes);
+}
+
+int posix_memalign(void** memptr, size_t align, size_t size) noexcept {
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0 || align == 0) {
+        return EINVAL;
+    }
+    void* ptr = hookAllocAligned(align, size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t align, size_t size) noexcept {
+    return hookAllocAligned(align, size);
+}
+
+void* memalign(size_t align, size_t size) noexcept {
+    // 与glibc一致 不是2的整数次幂的对齐数向上取整
+    size_t pow2 = sizeof(void*);
+    while (pow2 < align && pow2 != 0) {
+        pow2 <<= 1;
+    }
+    if (pow2 == 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return hookAllocAligned(pow2, size);
+}
+
+void* valloc(size_t size) noexcept {
+    return hookAllocAligned(getpagesize(), size);
+}
+
+void* pvalloc(size_t size) noexcept {
+    size_t pagesize = getpagesize();
+    size_t bytes    = 0;
+    if (__builtin_add_overflow(size, pagesize - 1, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return hookAllocAligned(pagesize, bytes & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void* ptr) noexcept {
+    return concurrentUsableSize(ptr);
+}
+}
+#endif
@@ -0,0 +1,120 @@
+#include "mallocstats.h"
+#include "centralcache.h"
+#include "cpucache.h"
+#include "pagecache.h"
+#include "threadcache.h"
+#include <cstdio>
+#include <cstring>
+using namespace apollo;
+
+/**
+ * @brief 从/proc/self/smaps_rollup中读取由透明大页支撑的字节数
+ */
+static size_t readAnonHugePages() {
+    size_t res = 0;
+#ifdef __linux__
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        size_t kb = 0;
+        if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            res = kb << 10;
+            break;
+        }
+    }
+    fclose(fp);
+#endif
+    return res;
+}
+
+void MallocStats::collect(MallocStats& stats) {
+    memset(&stats, 0, sizeof(stats));
+    for (size_t i = 0; i < kBucketSize; i++) {
+        stats.classes_[i].size_ = AlignHelper::classSize(i);
+    }
+
+    // 依次收集每一层的统计信息 每次只持有一把锁
+    for (size_t i = 0; i < kTotalPageShards; i++) {
+        PageCache::getInstance(i)->collectStats(stats);
+    }
+    for (size_t i = 0; i < kMaxNumaNodes; i++) {
+        CentralCache::getInstance(i)->collectStats(stats);
+    }
+#ifdef APLPERCPU
+    CpuCache::getInstance()->collectStats(stats);
+#else
+    ThreadCache::collectStats(stats);
+#endif
+
+    // 分配给ThreadCache的对象中 扣除仍缓存在各级缓存中的部分即为正在使用的
+    for (size_t i = 0; i < kBucketSize; i++) {
+        SizeClassStats& cls    = stats.classes_[i];
+        size_t          cached = cls.transferCacheBytes_ + cls.threadCacheBytes_ + cls.remoteFreeBytes_;
+        // 各层的数据并非同一时刻收集的 避免出现负数
+        cls.inUseBytes_ = cls.inUseBytes_ > cached ? cls.inUseBytes_ - cached : 0;
+        stats.inUseBytes_ += cls.inUseBytes_;
+    }
+    stats.inUseBytes_ += stats.largeBytes_;
+
+    // 读取文件时不持有任何锁
+    stats.anonHugePageBytes_ = readAnonHugePages();
+
+    // 驻留内存中未被使用的比例
+    size_t resident = stats.systemBytes_ - stats.releasedBytes_;
+    if (resident > 0 && resident > stats.inUseBytes_) {
+        stats.fragmentation_ = 1.0 - (double)stats.inUseBytes_ / resident;
+    }
+}
+
+std::string MallocStats::toString() const {
+    std::string res;
+    char        buf[1024];
+
+    const double kMB = 1024.0 * 1024.0;
+    snprintf(buf, sizeof(buf),
+             "------------------------------------------------\n"
+             "MALLOC: %12.1f MiB  in use by application\n"
+             "MALLOC: %12.1f MiB  in thread caches (%zu caches, %.1f MiB limit)\n"
+             "MALLOC: %12.1f MiB  in transfer caches\n"
+             "MALLOC: %12.1f MiB  in central cache spans\n"
+             "MALLOC: %12.1f MiB  in remote free queues\n"
+             "MALLOC: %12.1f MiB  in page cache (%.1f MiB released)\n"
+             "MALLOC: %12.1f MiB  in %zu large allocations\n"
+             "MALLOC: %12.1f MiB  obtained from system\n"
+             "MALLOC: %12.1f MiB  advised as huge pages (%.1f MiB backed)\n"
+             "MALLOC: %12.2f %%    fragmentation\n",
+             inUseBytes_ / kMB, threadCacheBytes_ / kMB, threadCaches_, threadCacheLimit_ / kMB,
+             transferCacheBytes_ / kMB,
+             centralCacheBytes_ / kMB, remoteFreeBytes_ / kMB, pageCacheBytes_ / kMB, releasedBytes_ / kMB,
+             largeBytes_ / kMB, largeSpans_, systemBytes_ / kMB, hugePageBytes_ / kMB, anonHugePageBytes_ / kMB,
+             fragmentation_ * 100);
+    res += buf;
+
+    res += "------------------------------------------------\n";
+    res += "class    size      in use    thread  transfer   central    remote  spans\n";
+    for (size_t i = 0; i < kBucketSize; i++) {
+        const SizeClassStats& cls = classes_[i];
+        if (cls.spans_ == 0 && cls.threadCacheBytes_ == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%5zu %7zu %11zu %9zu %9zu %9zu %9zu %6zu\n", i, cls.size_, cls.inUseBytes_,
+                 cls.threadCacheBytes_, cls.transferCacheBytes_, cls.centralCacheBytes_, cls.remoteFreeBytes_,
+                 cls.spans_);
+        res += buf;
+    }
+
+    res += "------------------------------------------------\n";
+    res += "pages   spans       bytes    released\n";
+    for (size_t i = 1; i < kPageBucketSize; i++) {
+        const PageBucketStats& bucket = pageBuckets_[i];
+        if (bucket.spans_ == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%5zu %7zu %11zu %11zu\n", i, bucket.spans_, bucket.bytes_, bucket.releasedBytes_);
+        res += buf;
+    }
+    return res;
+}
@@ -0,0 +1,103 @@
+#include "numa.h"
+#ifdef APLNUMA
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace apollo;
+
+/**
+ * @brief 读取sysfs中的文件，不经过stdio以免申请内存
+ * @return 读取成功时返回true，_buf以'\0'结尾
+ */
+static bool readSysfs(const char* path, char* buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+/**
+ * @brief 判断形如"0-3,8-11"的列表中是否包含_id
+ */
+static bool listContains(const char* list, size_t id) {
+    const char* p = list;
+    while (*p >= '0' && *p <= '9') {
+        char*  end   = nullptr;
+        size_t first = strtoul(p, &end, 10);
+        size_t last  = first;
+        if (*end == '-') {
+            last = strtoul(end + 1, &end, 10);
+        }
+        if (id >= first && id <= last) {
+            return true;
+        }
+        if (*end != ',') {
+            break;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+size_t NumaHelper::nodes() {
+    static size_t nodes = []() -> size_t {
+        // 格式为"0"或"0-1" 取最大的节点编号
+        char buf[64];
+        if (!readSysfs("/sys/devices/system/node/possible", buf, sizeof(buf))) {
+            return 1;
+        }
+        size_t      last = 0;
+        const char* p    = buf;
+        while (*p != '\0') {
+            if (*p >= '0' && *p <= '9') {
+                char* end = nullptr;
+                last      = strtoul(p, &end, 10);
+                p         = end;
+            } else {
+                p++;
+            }
+        }
+        return last + 1 < kMaxNumaNodes ? last + 1 : kMaxNumaNodes;
+    }();
+    return nodes;
+}
+
+size_t NumaHelper::currentNode() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return node % nodes();
+}
+
+size_t NumaHelper::nodeOfCpu(size_t cpu) {
+    char path[64];
+    char buf[256];
+    for (size_t node = 0; node < nodes(); node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+        if (readSysfs(path, buf, sizeof(buf)) && listContains(buf, cpu)) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+void NumaHelper::bind(void* ptr, size_t bytes, size_t node) {
+    if (nodes() <= 1) {
+        return;
+    }
+    // 优先从指定节点分配 该节点内存不足时仍可以从其它节点分配
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+#endif
@@ -1,14 +1,46 @@
 #include "pagecache.h"
+#include "mallocstats.h"
 #include <cassert>
+#include <chrono>
 using namespace apollo;
 
+/**
+ * @brief 获取单调递增时钟的当前毫秒数
+ */
+static uint64_t steadyMilliseconds() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 获取所有分片共享的页号到Span的映射
+ */
+static PageMap& pageMap() {
+    static PageMap map;
+    return map;
+}
+
+/**
+ * @brief 为依次构造的分片分配编号
+ */
+static uint8_t nextShard() {
+    static uint8_t shards = 0;
+    return shards++;
+}
+
+PageCache::PageCache()
+    : shard_(nextShard())
+    , hash_(pageMap())
+    , heap_(shard_ / kPageShards) {
+}
+
 Span* PageCache::newSpan(size_t npage) {
     assert(npage > 0);
 
     if (npage > kPageBucketSize - 1) // 大于128页直接找堆申请
     {
-        void* ptr     = systemAlloc(npage);
-        Span* span    = span_pool_.alloc();
+        void* ptr     = heap_.allocate(npage);
+        Span* span    = allocSpan();
         span->pageId_ = (page_t)ptr >> kPageShift;
         span->cnt_    = npage;
         // 建立页号与span之间的映射
@@ -17,9 +49,22 @@ Span* PageCache::newSpan(size_t npage) {
         return span;
     }
 
+    // 开始查找的桶
+    size_t first = npage;
+#ifdef APLHUGEPAGE
+    // 优先使用所在大页已有页被使用的span 使完全空闲的大页保持完整 以便整体归还给操作系统
+    Span* packed = findPackedSpan(npage);
+    if (packed != nullptr) {
+        first = packed->cnt_;
+        spanlists_[first].erase(packed);
+        spanlists_[first].pushFront(packed);
+    }
+#endif
+
     // 先检查第_npage个桶里面有没有span 有则直接返回
-    if (!spanlists_[npage].empty()) {
-        Span* res = spanlists_[npage].popFront();
+    if (first == npage && !spanlists_[npage].empty()) {
+        Span* res      = spanlists_[npage].popFront();
+        res->released_ = false; // 被归还的页再次访问时由内核重新分配
 
         // 建立页号与span的映射，方便CentralCache回收小块内存时查找对应的Span
         for (page_t i = 0; i < res->cnt_; i++) {
@@ -31,10 +76,10 @@ Span* PageCache::newSpan(size_t npage) {
     }
 
     // 如果没有则检查一下后面的桶里面有没有span 如果有可以将其进行切分
-    for (size_t i = npage + 1; i < kPageBucketSize; i++) {
+    for (size_t i = first > npage ? first : npage + 1; i < kPageBucketSize; i++) {
         if (!spanlists_[i].empty()) {
             Span* nSpan = spanlists_[i].popFront();
-            Span* kSpan = span_pool_.alloc();
+            Span* kSpan = allocSpan();
 
             // 在nSpan的头部切k页下来
             kSpan->pageId_ = nSpan->pageId_;
@@ -60,11 +105,13 @@ Span* PageCache::newSpan(size_t npage) {
         }
     }
 
-    // 走到这里说明后面没有大页的span了，这时就向堆申请一个128页的span
-    Span* largespan    = span_pool_.alloc();
-    void* ptr          = systemAlloc(kPageBucketSize - 1);
+    // 走到这里说明后面没有大页的span了，这时就向页堆申请一个128页的span
+    Span* largespan    = allocSpan();
+    void* ptr          = heap_.allocate(kPageBucketSize - 1);
     largespan->pageId_ = (page_t)ptr >> kPageShift;
     largespan->cnt_    = kPageBucketSize - 1;
+    // 提前开辟映射这些页所需的空间
+    hash_.ensure(largespan->pageId_, largespan->cnt_);
 
     spanlists_[largespan->cnt_].pushFront(largespan);
 
@@ -72,36 +119,89 @@ Span* PageCache::newSpan(size_t npage) {
     return newSpan(npage);
 }
 
-Span* PageCache::mapToSpan(void* obj) {
-    page_t id = (page_t)obj >> kPageShift; // 获取页号
-
-    // std::lock_guard<std::mutex> lock(mtx_);
-
-    // auto ret = hash_.find(id);
-    // if (ret != hash_.end())
-    //{
-    //	return ret->second;
-    // }
-    // else
-    //{
-    //	assert(false);
-    //	return nullptr;
-    // }
-
-    Span* ret = (Span*)hash_.get(id);
-    assert(ret);
-    return ret;
+Span* PageCache::newAlignedSpan(size_t npage, size_t alignpages) {
+    assert(npage > 0);
+    assert(alignpages > 0 && (alignpages & (alignpages - 1)) == 0);
+
+    // 多申请后超过128页的内存由页堆单独映射 切分后首尾的页分属不同的Span
+    // 而Windows上只能以映射的起始地址整体释放 因此这种情况直接单独映射一块对齐的内存
+    if (npage + alignpages - 1 > kPageBucketSize - 1) {
+        void* ptr     = heap_.allocateAligned(npage, alignpages);
+        Span* span    = allocSpan();
+        span->pageId_ = (page_t)ptr >> kPageShift;
+        span->cnt_    = npage;
+        span->used_   = true;
+        // 与newSpan一致 超过128页的Span只映射首页
+        // 不超过128页的Span释放后留在PageCache中 从不归还映射 需要映射每一页以便合并
+        if (npage > kPageBucketSize - 1) {
+            hash_.set(span->pageId_, span);
+        } else {
+            hash_.ensure(span->pageId_, npage);
+            for (page_t i = 0; i < npage; i++) {
+                hash_.set(span->pageId_ + i, span);
+            }
+        }
+        return span;
+    }
+
+    Span* span  = newSpan(npage + alignpages - 1);
+    span->used_ = true;
+
+    // 在span中找到按alignpages对齐的起始页
+    page_t start  = (span->pageId_ + alignpages - 1) & ~(page_t)(alignpages - 1);
+    size_t prefix = start - span->pageId_;
+    size_t suffix = span->cnt_ - prefix - npage;
+    if (prefix == 0 && suffix == 0) {
+        return span;
+    }
+
+    Span* res    = allocSpan();
+    res->pageId_ = start;
+    res->cnt_    = npage;
+    res->used_   = true;
+    // 先建立res的映射 使得首尾多余的页归还时不会与res合并
+    for (page_t i = 0; i < npage; i++) {
+        hash_.set(res->pageId_ + i, res);
+    }
+
+    if (suffix > 0) {
+        Span* tail    = allocSpan();
+        tail->pageId_ = start + npage;
+        tail->cnt_    = suffix;
+        tail->used_   = true;
+        revertSpanToPageCache(tail);
+    }
+
+    if (prefix > 0) {
+        span->cnt_ = prefix;
+        revertSpanToPageCache(span);
+    } else {
+        span_pool_.free(span);
+    }
+
+    return res;
 }
 
 void PageCache::revertSpanToPageCache(Span* span) {
-    if (span->cnt_ > kPageBucketSize - 1) // 大于128页直接释放给堆
+    if (span->cnt_ > kPageBucketSize - 1) // 大于128页直接释放给操作系统
     {
+        // 先清除映射，防止相邻的span合并时访问到已释放的span
+        // 解除映射后这段地址可能立即被其它分片重新映射 此时再清除会覆盖其它分片建立的映射
+        hash_.set(span->pageId_, nullptr);
         void* ptr = (void*)(span->pageId_ << kPageShift);
-        systemFree(ptr);
+        heap_.deallocate(ptr, span->cnt_);
         span_pool_.free(span);
         return;
     }
 
+    // 将该span设置为未被使用的状态 其物理内存仍然驻留
+    span->used_     = false;
+    span->released_ = false;
+    span->freeTime_ = steadyMilliseconds();
+    coalesce(span);
+}
+
+Span* PageCache::coalesce(Span* span) {
     // 对span的前后页，尝试进行合并，缓解内存碎片问题
     // 向前合并
     while (1) {
@@ -116,17 +216,33 @@ void PageCache::revertSpanToPageCache(Span* span) {
         if (ret == nullptr)
             break;
 
-        // 前面的页号对应的span正在被使用，停止向前合并
         // Span* prev_span = ret->second;
         Span* prev_span = ret;
+        // 属于其它分片的span由其它分片的锁保护，停止向前合并
+        if (prev_span->shard_.load(std::memory_order_relaxed) != shard_) {
+            break;
+        }
+
+        // 前面的页号对应的span正在被使用，停止向前合并
         if (prev_span->used_ == true) {
             break;
         }
 
+        // 物理内存是否已归还的状态不同时不合并 否则合并后的span无法准确记录其状态
+        if (prev_span->released_ != span->released_) {
+            break;
+        }
+
         // 合并出超过128页的span无法进行管理，停止向前合并
         if (prev_span->cnt_ + span->cnt_ > kPageBucketSize - 1) {
             break;
         }
+#ifdef APLHUGEPAGE
+        // 不跨越大页合并 使得每个大页都可以整体归还给操作系统
+        if ((prev_span->pageId_ ^ span->pageId_) & ~(page_t)(kHugePagePages - 1)) {
+            break;
+        }
+#endif
 
         // 进行向前合并
         span->pageId_ = prev_span->pageId_;
@@ -151,17 +267,33 @@ void PageCache::revertSpanToPageCache(Span* span) {
         if (ret == nullptr)
             break;
 
-        // 后面的页号对应的span正在被使用，停止向后合并
         // Span* next_span = ret->second;
         Span* next_span = ret;
+        // 属于其它分片的span由其它分片的锁保护，停止向后合并
+        if (next_span->shard_.load(std::memory_order_relaxed) != shard_) {
+            break;
+        }
+
+        // 后面的页号对应的span正在被使用，停止向后合并
         if (next_span->used_ == true) {
             break;
         }
 
+        // 物理内存是否已归还的状态不同时不合并
+        if (next_span->released_ != span->released_) {
+            break;
+        }
+
         // 合并出超过128页的span无法进行管理，停止向后合并
         if (next_span->cnt_ + span->cnt_ > kPageBucketSize - 1) {
             break;
         }
+#ifdef APLHUGEPAGE
+        // 不跨越大页合并 使得每个大页都可以整体归还给操作系统
+        if ((span->pageId_ ^ next_span->pageId_) & ~(page_t)(kHugePagePages - 1)) {
+            break;
+        }
+#endif
 
         // 进行向后合并
         span->cnt_ += next_span->cnt_;
@@ -172,14 +304,158 @@ void PageCache::revertSpanToPageCache(Span* span) {
         span_pool_.free(next_span);
     }
 
-    // 将合并后的span挂到对应的双链表当中
-    spanlists_[span->cnt_].pushFront(span);
+    // 将合并后的span挂到对应的双链表当中 已归还的span挂到链表尾部 使得newSpan优先复用仍驻留在物理内存中的span
+    if (span->released_) {
+        spanlists_[span->cnt_].insert(spanlists_[span->cnt_].end(), span);
+    } else {
+        spanlists_[span->cnt_].pushFront(span);
+    }
     // 建立该span与其首尾页的映射
-    // hash_[span->page_id_] = span;
-    // hash_[span->page_id_ + span->cnt_ - 1] = span;
     hash_.set(span->pageId_, span);
     hash_.set(span->pageId_ + span->cnt_ - 1, span);
+    return span;
+}
+
+size_t PageCache::releaseToSystem(size_t bytes, uint64_t idleMs) {
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    uint64_t now      = steadyMilliseconds();
+    size_t   released = 0;
+    // 从页数最多的桶开始 将尚未归还且空闲足够久的span归还给操作系统
+    for (size_t i = kPageBucketSize - 1; i > 0 && released < bytes; i--) {
+        Span* it = spanlists_[i].begin();
+        while (it != spanlists_[i].end() && released < bytes) {
+            if (it->released_ || now - it->freeTime_ < idleMs) {
+                it = it->next_;
+                continue;
+            }
+
+#ifdef APLHUGEPAGE
+            // 只归还所有页都空闲的大页 避免内核将大页拆分成普通页
+            Span*  group[kHugePagePages];
+            size_t n = collectHugePage(it, now, idleMs, group);
+            if (n == 0) {
+                it = it->next_;
+                continue;
+            }
+            // 大页中已经归还过的span不计入本次归还的字节数
+            size_t resident = 0;
+            for (size_t k = 0; k < n; k++) {
+                spanlists_[group[k]->cnt_].erase(group[k]);
+                group[k]->used_ = true;
+                if (!group[k]->released_) {
+                    resident += group[k]->cnt_;
+                }
+            }
+
+            lock.unlock();
+            heap_.release((void*)(group[0]->pageId_ << kPageShift), kHugePagePages);
+            lock.lock();
 
-    // 将该span设置为未被使用的状态
-    span->used_ = false;
+            // 依次与前面已归还的span合并 后面的span仍被标记为正在使用 不会被提前合并
+            for (size_t k = 0; k < n; k++) {
+                group[k]->used_     = false;
+                group[k]->released_ = true;
+                coalesce(group[k]);
+            }
+            released += resident << kPageShift;
+#else
+            // 先将span从链表中摘下并标记为正在使用 防止在解锁期间被分配或合并
+            Span* span = it;
+            spanlists_[i].erase(span);
+            span->used_ = true;
+
+            lock.unlock();
+            heap_.release((void*)(span->pageId_ << kPageShift), span->cnt_);
+            lock.lock();
+
+            // 与相邻的已归还的span合并后挂到链表尾部
+            released += span->cnt_ << kPageShift;
+            span->used_     = false;
+            span->released_ = true;
+            coalesce(span);
+#endif
+
+            // 解锁期间链表可能已经发生变化 重新遍历
+            it = spanlists_[i].begin();
+        }
+    }
+    return released;
+}
+
+#ifdef APLHUGEPAGE
+Span* PageCache::findPackedSpan(size_t npage) {
+    size_t scanned = 0;
+    for (size_t i = npage; i < kPageBucketSize; i++) {
+        SpanList& list = spanlists_[i];
+        for (Span* it = list.begin(); it != list.end(); it = it->next_) {
+            if (hugePageInUse(it)) {
+                return it;
+            }
+            if (++scanned >= kPackScanSpans) {
+                return nullptr;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool PageCache::hugePageInUse(const Span* span) const {
+    page_t hugepage = span->pageId_ & ~(page_t)(kHugePagePages - 1);
+    // 空闲的span会与相邻的空闲span合并 相邻的页未被合并时通常正在被使用
+    page_t neighbors[2] = { span->pageId_ - 1, span->pageId_ + span->cnt_ };
+    for (page_t id : neighbors) {
+        if ((id & ~(page_t)(kHugePagePages - 1)) != hugepage) {
+            continue;
+        }
+        Span* cur = (Span*)hash_.get(id);
+        if (cur != nullptr
+            && (cur->shard_.load(std::memory_order_relaxed) != shard_ || cur->used_)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t PageCache::collectHugePage(const Span* span, uint64_t now, uint64_t idleMs, Span** group) {
+    page_t start = span->pageId_ & ~(page_t)(kHugePagePages - 1);
+    page_t id    = start;
+    size_t n     = 0;
+    // 从大页的首页开始依次查找相邻的span 每个span的首页都建立了映射
+    while (id < start + kHugePagePages) {
+        Span* cur = (Span*)hash_.get(id);
+        if (cur == nullptr || cur->shard_.load(std::memory_order_relaxed) != shard_ || cur->pageId_ != id || cur->used_ == true
+            || now - cur->freeTime_ < idleMs) {
+            return 0;
+        }
+        group[n++] = cur;
+        id += cur->cnt_;
+    }
+    // 最后一个span越过了大页的边界
+    if (id != start + kHugePagePages) {
+        return 0;
+    }
+    return n;
+}
+#endif
+
+void PageCache::collectStats(MallocStats& stats) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (size_t i = 1; i < kPageBucketSize; i++) {
+        PageBucketStats& bucket = stats.pageBuckets_[i];
+        for (Span* span = spanlists_[i].begin(); span != spanlists_[i].end(); span = span->next_) {
+            size_t bytes = span->cnt_ << kPageShift;
+            bucket.spans_++;
+            bucket.bytes_ += bytes;
+            stats.pageCacheBytes_ += bytes;
+            if (span->released_) {
+                bucket.releasedBytes_ += bytes;
+                stats.releasedBytes_ += bytes;
+            }
+        }
+    }
+    stats.largeSpans_ += largeSpans_;
+    stats.largeBytes_ += largeBytes_;
+    stats.systemBytes_ += heap_.systemBytes();
+    stats.hugePageBytes_ += heap_.hugePageBytes();
 }
@@ -0,0 +1,155 @@
+#include "pageheap.h"
+#include "numa.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+using namespace apollo;
+
+void* PageHeap::allocate(size_t npage) {
+    assert(npage > 0);
+
+    // 超过128页的内存直接单独映射
+    if (npage > kPageBucketSize - 1) {
+        void* ptr = systemAlloc(npage);
+        NumaHelper::bind(ptr, npage << kPageShift, node_);
+        systemBytes_ += npage << kPageShift;
+        return ptr;
+    }
+
+    // 当前区域剩余的地址空间不足时 重新预留一块区域
+    // 旧区域中剩下的地址空间从未提交过 不占用物理内存
+    if (regionRemain_ < npage) {
+        reserveRegion();
+    }
+
+    char*  ptr   = region_;
+    size_t bytes = npage << kPageShift;
+
+    // 提交这一段地址空间
+    if (ptr + bytes > committed_) {
+#ifdef APLHUGEPAGE
+        // 以大页为单位提交 区域的大小是大页的整数倍
+        size_t hugepage = (size_t)1 << kHugePageShift;
+        char*  end      = (char*)(((uintptr_t)(ptr + bytes) + hugepage - 1) & ~(uintptr_t)(hugepage - 1));
+        commit(committed_, end - committed_);
+        hugePageBytes_ += end - committed_;
+        committed_ = end;
+#else
+        commit(ptr, bytes);
+        committed_ = ptr + bytes;
+#endif
+    }
+
+    region_ += bytes;
+    regionRemain_ -= npage;
+    systemBytes_ += bytes;
+    return ptr;
+}
+
+void* PageHeap::allocateAligned(size_t npage, size_t alignpages) {
+    assert(npage > 0);
+    assert(alignpages > 0 && (alignpages & (alignpages - 1)) == 0);
+
+    size_t    bytes = npage << kPageShift;
+    size_t    total = (npage + alignpages - 1) << kPageShift;
+    uintptr_t mask  = (alignpages << kPageShift) - 1;
+#ifdef _WIN32
+    // VirtualFree只能以映射的起始地址释放 先预留足够大的地址空间找到对齐的地址 再在该地址处重新映射
+    // 释放预留与重新映射之间该地址可能被其它线程占用 此时重试
+    void* ptr = nullptr;
+    while (ptr == nullptr) {
+        void* probe = VirtualAlloc(0, total, MEM_RESERVE, PAGE_NOACCESS);
+        if (probe == nullptr) {
+            throw std::bad_alloc();
+        }
+        VirtualFree(probe, 0, MEM_RELEASE);
+        void* aligned = (void*)(((uintptr_t)probe + mask) & ~mask);
+        ptr           = VirtualAlloc(aligned, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    }
+#elif __linux__
+    void* ptr = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    // 解除首尾多余部分的映射
+    char*  start = (char*)(((uintptr_t)ptr + mask) & ~mask);
+    size_t head  = start - (char*)ptr;
+    if (head > 0) {
+        munmap(ptr, head);
+    }
+    if (total - head - bytes > 0) {
+        munmap(start + bytes, total - head - bytes);
+    }
+    ptr = start;
+#endif
+    NumaHelper::bind(ptr, bytes, node_);
+    systemBytes_ += bytes;
+    return ptr;
+}
+
+void PageHeap::deallocate(void* ptr, size_t npage) {
+    assert(npage > kPageBucketSize - 1);
+    systemFree(ptr, npage);
+    systemBytes_ -= npage << kPageShift;
+}
+
+void PageHeap::release(void* ptr, size_t npage) {
+#ifdef _WIN32
+    VirtualAlloc(ptr, npage << kPageShift, MEM_RESET, PAGE_READWRITE);
+#elif __linux__
+    madvise(ptr, npage << kPageShift, MADV_DONTNEED);
+#endif
+}
+
+void PageHeap::reserveRegion() {
+    size_t bytes = kRegionPages << kPageShift;
+#ifdef _WIN32
+    void* ptr = VirtualAlloc(0, bytes, MEM_RESERVE, PAGE_NOACCESS);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+#elif __linux__
+#ifdef APLHUGEPAGE
+    // 多预留一个大页的地址空间 以便将区域的起始地址按大页对齐
+    size_t hugepage = (size_t)1 << kHugePageShift;
+    size_t reserve  = bytes + hugepage;
+#else
+    size_t reserve = bytes;
+#endif
+    // 只预留地址空间 不可访问也不计入提交的内存
+    void* ptr = mmap(nullptr, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef APLHUGEPAGE
+    // 解除首尾多余部分的映射
+    char*  start = (char*)(((uintptr_t)ptr + hugepage - 1) & ~(uintptr_t)(hugepage - 1));
+    size_t head  = start - (char*)ptr;
+    if (head > 0) {
+        munmap(ptr, head);
+    }
+    if (hugepage - head > 0) {
+        munmap(start + bytes, hugepage - head);
+    }
+    ptr = start;
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+    // 整个区域的物理内存都优先从所属的节点分配
+    NumaHelper::bind(ptr, bytes, node_);
+    region_       = static_cast<char*>(ptr);
+    committed_    = region_;
+    regionRemain_ = kRegionPages;
+}
+
+void PageHeap::commit(void* ptr, size_t bytes) {
+#ifdef _WIN32
+    if (VirtualAlloc(ptr, bytes, MEM_COMMIT, PAGE_READWRITE) == nullptr) {
+        throw std::bad_alloc();
+    }
+#elif __linux__
+    if (mprotect(ptr, bytes, PROT_READ | PROT_WRITE) != 0) {
+        throw std::bad_alloc();
+    }
+#endif
+}
@@ -0,0 +1,72 @@
+#include "scavenger.h"
+#include "common.h"
+#include "configparser.h"
+#include "pagecache.h"
+#include "threadcache.h"
+#include <chrono>
+#include <functional>
+using namespace apollo;
+
+Scavenger::Scavenger()
+    : running_(false)
+    , releaseRate_(0)
+    , releaseAgeMs_(0)
+    , interval_(1) {
+}
+
+Scavenger::~Scavenger() {
+    stop();
+}
+
+void Scavenger::start() {
+    auto config = ConfigParser::getInstance()->mempoolConfig();
+    start(config.releaseRate, config.releaseAge, config.releaseInterval);
+}
+
+void Scavenger::start(size_t releaseRate, uint32_t releaseAge, uint32_t interval) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (running_ || releaseRate == 0) {
+        return;
+    }
+
+    releaseRate_  = releaseRate;
+    releaseAgeMs_ = static_cast<uint64_t>(releaseAge) * 1000;
+    interval_     = interval > 0 ? interval : 1;
+    running_      = true;
+
+    thread_ = std::thread(std::bind(&Scavenger::threadFunc, this));
+    ThreadHelper::SetThreadName(&thread_, "scavenger");
+}
+
+void Scavenger::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void Scavenger::threadFunc() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (running_) {
+        cond_.wait_for(lock, std::chrono::seconds(interval_));
+        if (!running_) {
+            break;
+        }
+
+        // 每个周期最多归还releaseRate_ * interval_字节 避免频繁的缺页中断
+        size_t   budget = releaseRate_ * interval_;
+        uint64_t ageMs  = releaseAgeMs_;
+        lock.unlock();
+        ThreadCache::releaseRemoteQueues();
+        size_t   released = 0;
+        for (size_t i = 0; i < kTotalPageShards && released < budget; i++) {
+            released += PageCache::getInstance(i)->releaseToSystem(budget - released, ageMs);
+        }
+        lock.lock();
+    }
+}
@@ -1,17 +1,94 @@
 #include "threadcache.h"
 #include "centralcache.h"
+#include "configparser.h"
+#include "mallocstats.h"
+#include "numa.h"
+#include "pagecache.h"
+#include <iostream>
+#ifdef __linux__
+#include <pthread.h>
+#endif
 using namespace apollo;
 
+TLS ThreadCache* ThreadCache::tlsThreadCache_ = nullptr;
+TLS bool         ThreadCache::tlsExited_      = false;
+
+namespace apollo {
+/**
+ * @brief 一个ThreadCache编号的远程释放队列
+ * @details 每个哈希桶一个无锁链表，其它线程通过CAS整批压入，所属线程通过exchange一次取走整个链表，
+ * 不会在链表中间摘除对象，因此不存在ABA问题。队列随编号复用而不会释放，
+ * 其它线程即使读到了过期的编号，也只会把对象送给该编号当前的所有者
+ */
+struct RemoteQueues {
+    std::atomic<void*>   heads_[kBucketSize];
+    std::atomic<int32_t> counts_[kBucketSize]; // 近似的对象个数，生产者先压入再计数，可能暂时为负
+    std::atomic<size_t>  node_ { 0 };          // 当前所有者绑定的NUMA节点
+
+    RemoteQueues() {
+        for (size_t i = 0; i < kBucketSize; i++) {
+            heads_[i].store(nullptr, std::memory_order_relaxed);
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+} // namespace apollo
+
+static std::mutex              s_poolmtx;
+static ObjectPool<ThreadCache> s_tcpool;
+static ThreadCache*            s_threadcaches = nullptr; // 正在使用的ThreadCache链表的头节点
+static ThreadCache*            s_nextStealer  = nullptr; // 下一个被窃取容量的ThreadCache
+
+// 已关闭的远程释放队列的链表头 线程退出后其它线程不再向其中送入对象
+static void* const kClosedQueue = reinterpret_cast<void*>(1);
+
+/// ThreadCache编号的上限 编号记录在页映射中 只占两个字节
+static const size_t kMaxCacheIds = 4096;
+
+// 编号到远程释放队列的映射 编号0不使用 队列在s_poolmtx的保护下创建 之后无锁读取
+static std::atomic<RemoteQueues*> s_remotes[kMaxCacheIds];
+// 以下变量均由s_poolmtx保护
+static ObjectPool<RemoteQueues> s_rqpool;
+static uint16_t                 s_freeIds[kMaxCacheIds]; // 已回收的编号
+static size_t                   s_freeIdCount = 0;
+static size_t                   s_nextId      = 1; // 从未使用过的最小编号
+
+/// 所有ThreadCache默认的总容量
+static const size_t kDefaultOverallCacheSize = 32 * 1024 * 1024;
+
+// 以下变量均由s_poolmtx保护
+// 均为常量初始化 替换malloc后可能在静态初始化之前就被使用
+static size_t  s_overallCacheSize = kDefaultOverallCacheSize; // 所有ThreadCache的总容量
+static int64_t s_unclaimedCache   = kDefaultOverallCacheSize; // 尚未分配给任何ThreadCache的容量 可能为负
+
+#ifdef __linux__
+/**
+ * @brief 创建用于在线程退出时回收ThreadCache的键
+ */
+static pthread_key_t createThreadKey(void (*destructor)(void*)) {
+    pthread_key_t key;
+    int           ret = pthread_key_create(&key, destructor);
+    assert(ret == 0);
+    (void)ret;
+    return key;
+}
+#endif
+
 void* ThreadCache::allocate(size_t size) {
     assert(size <= kMaxBytes);
 
-    size_t align = AlignHelper::roundUp(size);
     size_t index = AlignHelper::index(size);
+    size_t bytes = AlignHelper::classSize(index);
 
     if (!freelists_[index].empty()) {
+        size_ -= bytes;
+        return freelists_[index].pop();
+    } else if (remote_ != nullptr && drainRemote(index, bytes)) {
+        // 优先取回其它线程送回的对象 无需访问CentralCache
+        size_ -= bytes;
         return freelists_[index].pop();
     } else {
-        return fetchFromCentralCache(index, align);
+        return fetchFromCentralCache(index, bytes);
     }
 }
 
@@ -19,46 +96,419 @@ void ThreadCache::deallocate(void* ptr, size_t size) {
     assert(ptr && size <= kMaxBytes);
 
     // 找出对应的自由链表桶将对象插入
-    size_t index = AlignHelper::index(size);
-    freelists_[index].push(ptr);
+    size_t    index = AlignHelper::index(size);
+    size_t    bytes = AlignHelper::classSize(index);
+    FreeList& list  = freelists_[index];
+    list.push(ptr);
+    size_ += bytes;
 
-    // 当自由链表长度大于一次批量申请的对象个数时就开始还一段list给CentralCache
-    if (freelists_[index].size() >= freelists_[index].maxSize()) {
-        revertListToCentralCache(freelists_[index], size);
+    // 自由链表过长时归还一批对象 整个ThreadCache超出容量时回收各个自由链表中的空闲对象
+    if (list.size() > list.maxSize()) {
+        listTooLong(list, bytes);
+    } else if (size_ > maxSize_.load(std::memory_order_relaxed)) {
+        scavenge();
     }
 }
 
 void* ThreadCache::fetchFromCentralCache(size_t index, size_t size) {
+    FreeList& list     = freelists_[index];
+    size_t    batch    = AlignHelper::numMoveSize(size);
+    size_t    fetchnum = std::min(list.maxSize(), batch);
+
+    void * start = nullptr, *end = nullptr;
+    size_t actualnum = CentralCache::getInstance(node_)->fetchRangeObj(start, end, fetchnum, size, id_);
+    assert(actualnum >= 1); // 至少有一个对象
+
     // 慢开始反馈调节算法
     // 刚开始不会一次向CentralCache申请太多对象，因为太多了会造成内存浪费
-    // 如果不断有_size大小的需求，那么fetchnum就会不断增长 直到达到上限
-    size_t limit    = freelists_[index].maxSize();
-    size_t fetchnum = std::min(limit, AlignHelper::numMoveSize(size));
-    if (fetchnum == limit) {
-        freelists_[index].setMaxSize(limit + 1);
+    // 如果不断有_size大小的需求，那么maxSize先逐个增长到一批，之后按批增长 直到达到上限
+    if (list.maxSize() < batch) {
+        list.setMaxSize(list.maxSize() + 1);
+    } else {
+        size_t length = std::min(list.maxSize() + batch, kMaxFreeListLength);
+        list.setMaxSize(length - length % batch);
     }
 
-    void * start = nullptr, *end = nullptr;
-    size_t actualnum = CentralCache::getInstance()->fetchRangeObj(start, end, fetchnum, size);
-    assert(actualnum >= 1); // 至少有一个对象
+    if (actualnum > 1) // 申请到对象的个数是多个，还需要将剩下的对象挂到ThreadCache中对应的哈希桶中
+    {
+        list.pushRange(nextObj(start), end, actualnum - 1);
+        size_ += (actualnum - 1) * size;
+        if (size_ > maxSize_.load(std::memory_order_relaxed)) {
+            scavenge();
+        }
+    }
+    return start;
+}
+
+void ThreadCache::revertListToCentralCache(FreeList& list, size_t size, size_t cnt) {
+    size_t batch = AlignHelper::numMoveSize(size);
+    size_ -= cnt * size;
+    while (cnt > 0) {
+        size_t n     = std::min(cnt, batch);
+        void * start = nullptr, *end = nullptr;
+        list.popRange(start, end, n);
+
+        returnRange(start, size);
+        cnt -= n;
+    }
+}
+
+bool ThreadCache::drainRemote(size_t index, size_t size) {
+    std::atomic<void*>& head = remote_->heads_[index];
+    if (head.load(std::memory_order_relaxed) == nullptr) {
+        return false;
+    }
+    void* start = head.exchange(nullptr, std::memory_order_acquire);
+    if (start == nullptr) {
+        return false;
+    }
+    void*  end = start;
+    size_t cnt = 1;
+    while (nextObj(end) != nullptr) {
+        end = nextObj(end);
+        cnt++;
+    }
+    remote_->counts_[index].fetch_sub(static_cast<int32_t>(cnt), std::memory_order_relaxed);
+    freelists_[index].pushRange(start, end, cnt);
+    size_ += cnt * size;
+    return true;
+}
+
+void ThreadCache::returnRange(void* start, size_t size) {
+    struct Group {
+        size_t id_;
+        void*  start_;
+        void*  end_;
+        size_t cnt_;
+    };
+    // 第0组还给CentralCache 其余各组送往各自的来源线程
+    Group  groups[kMaxRemoteGroups + 1] = {};
+    size_t ngroups                      = 1;
+
+    PageCache* pages = PageCache::getInstance();
+    while (start != nullptr) {
+        void*  next = nextObj(start);
+        size_t id   = id_ != 0 ? pages->originOf(start) : 0;
+        size_t g    = 0;
+        if (id != 0 && id != id_) {
+            for (g = 1; g < ngroups && groups[g].id_ != id; g++) { }
+            if (g == ngroups) {
+                if (ngroups <= kMaxRemoteGroups) {
+                    groups[ngroups++].id_ = id;
+                } else {
+                    g = 0;
+                }
+            }
+        }
+        Group& group = groups[g];
+        if (group.start_ == nullptr) {
+            group.end_ = start;
+        }
+        nextObj(start) = group.start_;
+        group.start_   = start;
+        group.cnt_++;
+        start = next;
+    }
+
+    size_t index = AlignHelper::index(size);
+    size_t limit = kMaxRemoteBatches * AlignHelper::numMoveSize(size);
+    for (size_t g = 1; g < ngroups; g++) {
+        Group& group = groups[g];
+        if (!pushRemote(group.id_, node_, index, group.start_, group.end_, group.cnt_, limit)) {
+            // 来源线程已退出或者其队列已满 并入第0组
+            if (groups[0].start_ == nullptr) {
+                groups[0].end_ = group.end_;
+            }
+            nextObj(group.end_) = groups[0].start_;
+            groups[0].start_    = group.start_;
+            groups[0].cnt_ += group.cnt_;
+        }
+    }
+    if (groups[0].cnt_ > 0) {
+        // 将其余的对象整批还给CentralCache
+        CentralCache::getInstance(node_)->insertRange(groups[0].start_, groups[0].end_, groups[0].cnt_, size);
+    }
+}
+
+/**
+ * @brief 将一个远程释放队列中的对象全部还给其所属节点的CentralCache
+ * @details 通过exchange整体取走链表，所属线程与回收线程可以同时调用
+ */
+static void releaseQueues(RemoteQueues* queues, bool close) {
+    size_t node = queues->node_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kBucketSize; i++) {
+        std::atomic<void*>& head = queues->heads_[i];
+        void*               list = head.load(std::memory_order_relaxed);
+        if (close) {
+            list = head.exchange(kClosedQueue, std::memory_order_acquire);
+        } else {
+            // 不能重新打开已关闭的队列
+            while (list != nullptr && list != kClosedQueue
+                   && !head.compare_exchange_weak(list, nullptr, std::memory_order_acquire, std::memory_order_relaxed)) { }
+        }
+        if (list == nullptr || list == kClosedQueue) {
+            continue;
+        }
+        size_t cnt = 0;
+        for (void* obj = list; obj != nullptr; obj = nextObj(obj)) {
+            cnt++;
+        }
+        queues->counts_[i].fetch_sub(static_cast<int32_t>(cnt), std::memory_order_relaxed);
+        CentralCache::getInstance(node)->releaseList(list, AlignHelper::classSize(i));
+    }
+}
+
+void ThreadCache::releaseRemote(bool close) {
+    releaseQueues(remote_, close);
+}
 
-    if (actualnum == 1) // 申请到对象的个数是一个，则直接将这一个对象返回即可
+void ThreadCache::releaseRemoteQueues() {
+    size_t ids = 0;
     {
-        assert(start == end);
-        return start;
-    } else // 申请到对象的个数是多个，还需要将剩下的对象挂到ThreadCache中对应的哈希桶中
+        std::lock_guard<std::mutex> lock(s_poolmtx);
+        ids = s_nextId;
+    }
+    // 队列创建后不会释放 无需持锁遍历 已关闭的队列为空
+    for (size_t id = 1; id < ids; id++) {
+        releaseQueues(s_remotes[id].load(std::memory_order_acquire), false);
+    }
+}
+
+bool ThreadCache::pushRemote(size_t id, size_t node, size_t index, void* start, void* end, size_t cnt, size_t limit) {
+    RemoteQueues* queues = s_remotes[id].load(std::memory_order_acquire);
+    if (queues == nullptr || queues->node_.load(std::memory_order_relaxed) != node
+        || queues->counts_[index].load(std::memory_order_relaxed) >= static_cast<int32_t>(limit)) {
+        return false;
+    }
+    std::atomic<void*>& head = queues->heads_[index];
+    void*               old  = head.load(std::memory_order_relaxed);
+    do {
+        if (old == kClosedQueue) {
+            return false;
+        }
+        nextObj(end) = old;
+    } while (!head.compare_exchange_weak(old, start, std::memory_order_release, std::memory_order_relaxed));
+    queues->counts_[index].fetch_add(static_cast<int32_t>(cnt), std::memory_order_relaxed);
+    return true;
+}
+
+void ThreadCache::listTooLong(FreeList& list, size_t size) {
+    size_t batch = AlignHelper::numMoveSize(size);
+    revertListToCentralCache(list, size, std::min(list.size(), batch));
+
+    if (list.maxSize() < batch) {
+        // 只释放不申请的线程也需要逐渐增大maxSize 以便整批归还对象
+        list.setMaxSize(list.maxSize() + 1);
+    } else if (list.maxSize() > batch) {
+        // 频繁超出说明maxSize过大 缩小一批
+        list.setOverages(list.overages() + 1);
+        if (list.overages() > kMaxOverages) {
+            list.setMaxSize(list.maxSize() - batch);
+            list.setOverages(0);
+        }
+    }
+}
+
+void ThreadCache::scavenge() {
+    for (size_t i = 0; i < kBucketSize; i++) {
+        FreeList& list = freelists_[i];
+        size_t    low  = list.lowWater();
+        if (low > 0) {
+            // 归还自上次回收以来从未被用到的对象的一半 同时缩小maxSize
+            size_t size  = AlignHelper::classSize(i);
+            size_t batch = AlignHelper::numMoveSize(size);
+            revertListToCentralCache(list, size, low > 1 ? low / 2 : 1);
+            if (list.maxSize() > batch) {
+                list.setMaxSize(std::max(list.maxSize() - batch, batch));
+            }
+        }
+        list.resetLowWater();
+    }
+    // 其它线程送回但一直未被取走的对象也还给CentralCache
+    if (remote_ != nullptr) {
+        releaseRemote(false);
+    }
+    increaseCacheLimit();
+}
+
+void ThreadCache::increaseCacheLimit() {
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    if (s_unclaimedCache > 0) {
+        s_unclaimedCache -= kStealAmount;
+        maxSize_.fetch_add(kStealAmount, std::memory_order_relaxed);
+        return;
+    }
+
+    // 总容量已经分配完 轮流从其它ThreadCache处窃取 被窃取者在下次释放时回收多出的对象
+    if (s_threadcaches == nullptr) {
+        return;
+    }
+    for (int i = 0; i < 10; i++) {
+        if (s_nextStealer == nullptr) {
+            s_nextStealer = s_threadcaches;
+        }
+        ThreadCache* victim = s_nextStealer;
+        s_nextStealer       = victim->next_;
+        if (victim == this) {
+            continue;
+        }
+        size_t limit = victim->maxSize_.load(std::memory_order_relaxed);
+        if (limit > kMinCacheSize) {
+            victim->maxSize_.fetch_sub(kStealAmount, std::memory_order_relaxed);
+            maxSize_.fetch_add(kStealAmount, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ThreadCache::releaseAll() {
+    // 依次遍历每个哈希桶 将其自由链表整体归还给对应的Span
+    for (size_t i = 0; i < kBucketSize; i++) {
+        void* start = freelists_[i].clear();
+        if (start != nullptr) {
+            CentralCache::getInstance(node_)->releaseList(start, AlignHelper::classSize(i));
+        }
+    }
+}
+
+ThreadCache* ThreadCache::create() {
     {
-        freelists_[index].pushRange(nextObj(start), end, actualnum - 1);
-        return start;
+        std::lock_guard<std::mutex> lock(s_poolmtx);
+        tlsThreadCache_ = s_tcpool.alloc();
+        tlsThreadCache_->bindNode(NumaHelper::currentNode());
+        attachRemoteLocked(tlsThreadCache_);
+        linkLocked(tlsThreadCache_);
     }
+#ifdef __linux__
+    // 回收函数只在键值非空时调用 因此在TLS指针设置完成后再设置键值
+    static pthread_key_t key = createThreadKey(&ThreadCache::destroy);
+    pthread_setspecific(key, tlsThreadCache_);
+#endif
+    return tlsThreadCache_;
 }
 
-void ThreadCache::revertListToCentralCache(FreeList& list, size_t size) {
-    // void* start = nullptr, * end = nullptr;
-    //// 从list中取出一次批量个数的对象
-    //_list.PopRange(start, end, _list.MaxSize());
-    void* start = list.clear();
+void ThreadCache::registerCache(ThreadCache* cache) {
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    linkLocked(cache);
+}
 
-    // 将取出的对象还给CentralCache中对应的Span
-    CentralCache::getInstance()->releaseList(start, size);
+void ThreadCache::attachRemoteLocked(ThreadCache* cache) {
+    size_t id = 0;
+    if (s_freeIdCount > 0) {
+        id = s_freeIds[--s_freeIdCount];
+    } else if (s_nextId < kMaxCacheIds) {
+        id = s_nextId++;
+        s_remotes[id].store(s_rqpool.alloc(), std::memory_order_release);
+    } else {
+        return; // 编号已用完 该线程释放的对象不再区分来源
+    }
+    RemoteQueues* queues = s_remotes[id].load(std::memory_order_relaxed);
+    // 编号复用后 其它线程可能仍按旧的来源送入对象 只接受与新所有者同一节点的对象
+    queues->node_.store(cache->node_, std::memory_order_relaxed);
+    // 重新打开上一个所有者关闭的队列
+    for (size_t i = 0; i < kBucketSize; i++) {
+        queues->heads_[i].store(nullptr, std::memory_order_release);
+    }
+    cache->id_     = static_cast<uint16_t>(id);
+    cache->remote_ = queues;
+}
+
+void ThreadCache::linkLocked(ThreadCache* cache) {
+    s_unclaimedCache -= cache->maxSize_.load(std::memory_order_relaxed);
+    cache->next_ = s_threadcaches;
+    if (s_threadcaches != nullptr) {
+        s_threadcaches->prev_ = cache;
+    }
+    s_threadcaches = cache;
+}
+
+void ThreadCache::destroy(void* cache) {
+    ThreadCache* tc = static_cast<ThreadCache*>(cache);
+    tc->releaseAll();
+    // 先关闭远程释放队列 之后其它线程释放的本线程的对象直接还给CentralCache
+    if (tc->remote_ != nullptr) {
+        tc->releaseRemote(true);
+    }
+
+    // 此后本线程其他的TLS析构过程中若仍有内存申请 会重新创建ThreadCache 释放则直接还给CentralCache
+    if (tlsThreadCache_ == tc) {
+        tlsThreadCache_ = nullptr;
+        tlsExited_      = true;
+    }
+
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    if (tc->id_ != 0) {
+        s_freeIds[s_freeIdCount++] = tc->id_;
+    }
+    s_unclaimedCache += tc->maxSize_.load(std::memory_order_relaxed);
+    if (s_nextStealer == tc) {
+        s_nextStealer = tc->next_;
+    }
+    if (tc->prev_ != nullptr) {
+        tc->prev_->next_ = tc->next_;
+    } else {
+        s_threadcaches = tc->next_;
+    }
+    if (tc->next_ != nullptr) {
+        tc->next_->prev_ = tc->prev_;
+    }
+    s_tcpool.free(tc);
+}
+
+void ThreadCache::setOverallCacheSize(size_t bytes) {
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    if (bytes < kMinCacheSize) {
+        bytes = kMinCacheSize;
+    }
+    s_unclaimedCache += static_cast<int64_t>(bytes) - static_cast<int64_t>(s_overallCacheSize);
+    s_overallCacheSize = bytes;
+}
+
+#ifdef TCMALLOC
+/**
+ * @brief 按照配置文件设置所有ThreadCache的总容量
+ * @details 在加载内存池时执行，不依赖TcpServer或回收线程的启动。不在第一次创建ThreadCache时读取配置，
+ * 因为读取配置本身会申请内存，替换malloc后会再次进入创建ThreadCache的流程
+ */
+static bool applyConfiguredCacheSize() {
+    ThreadCache::setOverallCacheSize(ConfigParser::getInstance()->mempoolConfig().threadCacheSize);
+    return true;
+}
+
+static const bool s_cacheSizeConfigured = applyConfiguredCacheSize();
+#endif
+
+size_t ThreadCache::overallCacheSize() {
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    return s_overallCacheSize;
+}
+
+void ThreadCache::addStats(MallocStats& stats) const {
+    for (size_t i = 0; i < kBucketSize; i++) {
+        size_t bytes = freelists_[i].size() * AlignHelper::classSize(i);
+        stats.classes_[i].threadCacheBytes_ += bytes;
+        stats.threadCacheBytes_ += bytes;
+    }
+    stats.threadCaches_++;
+}
+
+void ThreadCache::collectStats(MallocStats& stats) {
+    // 其他线程可能正在修改其自由链表 读取到的长度是近似值
+    std::lock_guard<std::mutex> lock(s_poolmtx);
+    stats.threadCacheLimit_ = s_overallCacheSize;
+    for (ThreadCache* tc = s_threadcaches; tc != nullptr; tc = tc->next_) {
+        tc->addStats(stats);
+    }
+    // 远程释放队列中的对象尚未被来源线程取回 也属于缓存的部分
+    for (size_t id = 1; id < s_nextId; id++) {
+        RemoteQueues* queues = s_remotes[id].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kBucketSize; i++) {
+            int32_t cnt = queues->counts_[i].load(std::memory_order_relaxed);
+            if (cnt > 0) {
+                size_t bytes = cnt * AlignHelper::classSize(i);
+                stats.classes_[i].remoteFreeBytes_ += bytes;
+                stats.remoteFreeBytes_ += bytes;
+            }
+        }
+    }
 }
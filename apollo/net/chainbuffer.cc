@@ -0,0 +1,113 @@
+#include "chainbuffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+using namespace apollo;
+
+void ChainBuffer::retrieve(size_t len) {
+    while (len > 0 && head_ != nullptr) {
+        size_t readable = head_->readable();
+        if (len < readable) {
+            head_->begin_ += len;
+            readable_ -= len;
+            return;
+        }
+        len -= readable;
+        readable_ -= readable;
+        popFront();
+    }
+}
+
+void ChainBuffer::retrieveAll() {
+    while (head_ != nullptr) {
+        popFront();
+    }
+    readable_ = 0;
+}
+
+void ChainBuffer::append(const char* data, size_t len) {
+    while (len > 0) {
+        // 尾部不是内存块或者内存块已写满时 追加一个新的内存块
+        if (tail_ == nullptr || tail_->writable() == 0) {
+            Node* node   = new Node;
+            node->block_ = static_cast<Block*>(TypedPool<Block>::allocate());
+            node->begin_ = node->end_ = node->block_->data_;
+            pushBack(node);
+            blocks_++;
+        }
+        size_t n = std::min(len, tail_->writable());
+        memcpy(const_cast<char*>(tail_->end_), data, n);
+        tail_->end_ += n;
+        readable_ += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::appendRef(const void* data, size_t len, ReleaseCallback release) {
+    if (len < kMinRefBytes) {
+        append(static_cast<const char*>(data), len);
+        if (release) {
+            release();
+        }
+        return;
+    }
+    Node* node     = new Node;
+    node->begin_   = static_cast<const char*>(data);
+    node->end_     = node->begin_ + len;
+    node->release_ = std::move(release);
+    pushBack(node);
+    readable_ += len;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int& saveErrno) {
+    iovec vec[kMaxIovecs];
+    int   iovcnt = 0;
+    for (Node* node = head_; node != nullptr && iovcnt < kMaxIovecs; node = node->next_) {
+        if (node->readable() > 0) {
+            vec[iovcnt].iov_base = const_cast<char*>(node->begin_);
+            vec[iovcnt].iov_len  = node->readable();
+            iovcnt++;
+        }
+    }
+
+    ssize_t n = ::writev(fd, vec, iovcnt);
+    if (n < 0) {
+        saveErrno = errno;
+    }
+    return n;
+}
+
+void ChainBuffer::swap(ChainBuffer& rhs) {
+    std::swap(head_, rhs.head_);
+    std::swap(tail_, rhs.tail_);
+    std::swap(readable_, rhs.readable_);
+    std::swap(blocks_, rhs.blocks_);
+}
+
+void ChainBuffer::pushBack(Node* node) {
+    if (tail_ != nullptr) {
+        tail_->next_ = node;
+    } else {
+        head_ = node;
+    }
+    tail_ = node;
+}
+
+void ChainBuffer::popFront() {
+    Node* node = head_;
+    head_      = node->next_;
+    if (head_ == nullptr) {
+        tail_ = nullptr;
+    }
+
+    if (node->block_ != nullptr) {
+        TypedPool<Block>::deallocate(node->block_);
+        blocks_--;
+    }
+    if (node->release_) {
+        node->release_();
+    }
+    delete node;
+}
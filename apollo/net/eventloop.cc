@@ -26,6 +26,7 @@ EventLoop::EventLoop()
     : looping_(false)
     , quit_(false)
     , callingPendingFunctors_(false)
+    , sleeping_(false)
     , threadId_(ThreadHelper::ThreadId())
     , poller_(Poller::newDefaultPoller(this))
     , timerQueue_(new TimerQueue(this))
@@ -58,7 +59,16 @@ void EventLoop::loop() {
 
     while (!quit_) {
         activeChannels_.clear();
-        pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+        // 先声明即将阻塞再检查回调队列 与queueInLoop中先入队再检查sleeping_相对应
+        // 两者均为seq_cst操作 因此要么这里看到新的回调函数 要么queueInLoop看到sleeping_并唤醒
+        int timeoutMs = kPollTimeMs;
+        sleeping_.store(true);
+        if (!pendingFunctors_.empty()) {
+            sleeping_.store(false, std::memory_order_relaxed);
+            timeoutMs = 0;
+        }
+        pollReturnTime_ = poller_->poll(timeoutMs, &activeChannels_);
+        sleeping_.store(false, std::memory_order_relaxed);
         for (Channel* channel : activeChannels_) {
             // Poller监听那些Channel发生了事件，然后上报给EventLoop
             // 并通知Channel处理相应的事件
@@ -94,24 +104,17 @@ void EventLoop::runInLoop(Functor cb) {
         cb();
     } else {
         // 在非当前loop线程中执行 唤醒loop所在线程执行cb
-        queueInLoop(cb);
+        queueInLoop(std::move(cb));
     }
 }
 
 void EventLoop::queueInLoop(Functor cb) {
-    {
-        std::lock_guard<std::mutex> locker(mtx_);
-        pendingFunctors_.emplace_back(cb);
-    }
+    pendingFunctors_.push(std::move(cb));
 
-    // 唤醒相应的需要执行上面回调操作的loop线程
-    // 其中的第二个条件是为了处理如下情况：
-    // 如果此时处于loop所在线程，但是正在执行回调函数集合
-    // 且mainLoop已经给subLoop的回调函数队列中添加了新的回调函数
-    // 那么等其执行完成后 会继续回到poll处进行阻塞
-    // 那么刚才所添加的新的回调函数将得不到执行
-    // 为此在这种情况下 也需要wakeup将其唤醒继续执行回调操作
-    if (!isInLoopThread() || callingPendingFunctors_) {
+    // 只有loop正阻塞在epoll_wait中时才需要唤醒
+    // loop在阻塞之前会检查回调队列 因此正在执行回调函数或处理IO事件时新加入的回调函数不会被遗漏
+    // 多个线程同时看到sleeping_时 只有将其置为false的线程写wakeupfd
+    if (sleeping_.load() && sleeping_.exchange(false)) {
         wakeup(); // 唤醒loop所在线程
     }
 }
@@ -163,19 +166,10 @@ void EventLoop::handleRead() {
 }
 
 void EventLoop::doPendingFunctors() {
-    std::vector<Functor> functors;
     callingPendingFunctors_ = true;
 
-    // 防止MainLoop向SubLoop下发任务时时延过长
-    // 利用swap只交换vector底层的指针即可
-    // 减小了锁的粒度
-    {
-        std::lock_guard<std::mutex> locker(mtx_);
-        functors.swap(pendingFunctors_);
-    }
-
-    for (const auto& functor : functors) {
-        functor();
-    }
+    // 只执行本轮开始前已入队的回调函数 回调函数中新加入的留到下一轮
+    // 以免回调函数不断地向本loop投递任务时IO事件得不到处理
+    pendingFunctors_.consume([](Functor&& functor) { functor(); });
     callingPendingFunctors_ = false;
 }
\ No newline at end of file
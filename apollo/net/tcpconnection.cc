@@ -8,6 +8,17 @@
 #include <unistd.h>
 using namespace apollo;
 
+/**
+ * @brief 输入缓冲区读空后需要收缩的容量
+ * @details readFd自身就会按待读取的字节数扩容kMaxReadAhead，再追加临时缓冲区中的数据，
+ * 阈值须高于这一容量以及最近读取量的数倍，否则读取量稳定的连接每次读取都会收缩后再扩容
+ */
+static size_t shrinkThreshold(const Buffer& buf) {
+    size_t readAhead = Buffer::kMaxReadAhead + Buffer::kExtraBufSize;
+    size_t hinted    = 4 * buf.readHint();
+    return (readAhead > hinted ? readAhead : hinted) + Buffer::kCheapPrepend;
+}
+
 static EventLoop* CheckLoopNotNull(EventLoop* loop) {
     if (loop == nullptr) {
         LOG_FATAL(g_logger) << "loop is null!";
@@ -25,7 +36,9 @@ TcpConnection::TcpConnection(EventLoop* loop, const std::string& name, int sockf
     , channel_(new Channel(loop, sockfd))
     , localAddr_(localAddr)
     , peerAddr_(peerAddr)
-    , highWaterMark_(64 * 1024 * 1024) {
+    , highWaterMark_(64 * 1024 * 1024)
+    , lastReceiveTime_(Timestamp::now())
+    , inputBuffer_(0) {
     channel_->setReadCallback(std::bind(&TcpConnection::handleRead, this, std::placeholders::_1));
     channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
     channel_->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
@@ -42,14 +55,91 @@ TcpConnection::~TcpConnection() {
 void TcpConnection::send(const std::string& message) {
     if (state_ == kConnected) {
         if (loop_->isInLoopThread()) {
-            sendInLoop(message.c_str(), message.size());
+            sendInLoop(message.data(), message.size());
+        } else {
+            // 调用者的数据在返回后可能失效 复制一份交给事件循环
+            send(std::string(message));
+        }
+    }
+}
+
+void TcpConnection::send(std::string&& message) {
+    if (state_ == kConnected) {
+        if (message.size() >= ChainBuffer::kMinRefBytes) {
+            // 由共享指针持有数据 未发送的部分以引用的方式放入输出缓冲区 发送完成后释放
+            std::shared_ptr<std::string> owned = std::make_shared<std::string>(std::move(message));
+            if (loop_->isInLoopThread()) {
+                sendRefInLoop(owned->data(), owned->size(), [owned]() { });
+            } else {
+                loop_->runInLoop([conn = shared_from_this(), owned]() {
+                    conn->sendRefInLoop(owned->data(), owned->size(), [owned]() { });
+                });
+            }
+        } else if (loop_->isInLoopThread()) {
+            // 较短的数据即使未发送完也会被复制到输出缓冲区
+            sendInLoop(message.data(), message.size());
+        } else {
+            // 数据和连接均由回调函数持有 直到在事件循环中发送完成
+            loop_->runInLoop([conn = shared_from_this(), message = std::move(message)]() {
+                conn->sendInLoop(message.data(), message.size());
+            });
+        }
+    }
+}
+
+void TcpConnection::send(const void* data, size_t len) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendInLoop(data, len);
+        } else {
+            send(std::string(static_cast<const char*>(data), len));
+        }
+    }
+}
+
+void TcpConnection::send(Buffer* buf) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendInLoop(buf->peek(), buf->readableBytes());
+            buf->retrieveAll();
+        } else {
+            // Buffer的移动即复制 通过swap交出其内容
+            std::shared_ptr<Buffer> owned = std::make_shared<Buffer>(0);
+            owned->swap(*buf);
+            loop_->runInLoop([conn = shared_from_this(), owned]() {
+                conn->sendRefInLoop(owned->peek(), owned->readableBytes(), [owned]() { });
+            });
+        }
+    }
+}
+
+void TcpConnection::send(std::vector<std::string>&& messages) {
+    if (state_ == kConnected) {
+        // 移动vector不会搬移其中字符串的数据 输出缓冲区可以直接引用
+        std::shared_ptr<std::vector<std::string>> owned = std::make_shared<std::vector<std::string>>(std::move(messages));
+        if (loop_->isInLoopThread()) {
+            sendBatchInLoop(owned);
         } else {
+            loop_->runInLoop(std::bind(&TcpConnection::sendBatchInLoop, shared_from_this(), std::move(owned)));
+        }
+    }
+}
+
+void TcpConnection::send(const void* data, size_t len, ChainBuffer::ReleaseCallback release) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendRefInLoop(data, len, release);
+        } else {
+            // 数据由调用者持有 只需保证连接在发送时仍然存在
             loop_->runInLoop(std::bind(
-                &TcpConnection::sendInLoop,
-                this,
-                message.c_str(),
-                message.size()));
+                &TcpConnection::sendRefInLoop,
+                shared_from_this(),
+                data,
+                len,
+                std::move(release)));
         }
+    } else if (release) {
+        release();
     }
 }
 
@@ -90,8 +180,13 @@ void TcpConnection::handleRead(Timestamp receiveTime) {
     ssize_t n = inputBuffer_.readFd(channel_->fd(), saveErrno);
 
     if (n > 0) {
+        lastReceiveTime_ = receiveTime;
         // 已建立连接的用户 有可读事件发送 调用用户传入的MessageCallback
         messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+        // 突发的大包处理完后不再保留其峰值大小 之后的读取会按实际的数据量扩容
+        if (inputBuffer_.readableBytes() == 0 && inputBuffer_.internalCapacity() > shrinkThreshold(inputBuffer_)) {
+            inputBuffer_.shrink(0);
+        }
     } else if (n == 0) {
         handleClose();
     } else {
@@ -157,11 +252,77 @@ void TcpConnection::handleError() {
 }
 
 void TcpConnection::sendInLoop(const void* message, size_t len) {
+    sendRefInLoop(message, len, nullptr);
+}
+
+void TcpConnection::sendBatchInLoop(const std::shared_ptr<std::vector<std::string>>& messages) {
+    if (state_ == kDisconnected) {
+        LOG_ERROR(g_logger) << "disconnected, give up writing";
+        return;
+    }
+
+    // 所有数据先追加到输出缓冲区 较长的数据以引用的方式追加 每个节点都持有整批数据
+    size_t oldLen = outputBuffer_.readableBytes();
+    for (const std::string& message : *messages) {
+        if (message.size() >= ChainBuffer::kMinRefBytes) {
+            outputBuffer_.appendRef(message.data(), message.size(), [messages]() { });
+        } else {
+            outputBuffer_.append(message.data(), message.size());
+        }
+    }
+    size_t total = outputBuffer_.readableBytes();
+    if (total == oldLen) {
+        return;
+    }
+
+    bool faultError = false;
+    // 之前没有待发送的数据时 通过一次writev发送整批数据
+    if (!channel_->isWriteEvent() && oldLen == 0) {
+        int     saveErrno = 0;
+        ssize_t nwrote    = outputBuffer_.writeFd(channel_->fd(), saveErrno);
+        if (nwrote >= 0) {
+            outputBuffer_.retrieve(nwrote);
+            // 整批数据全部发送完成 只调用一次消息发送完成的回调函数
+            if (outputBuffer_.readableBytes() == 0 && writeCompleteCallback_) {
+                loop_->queueInLoop(std::bind(
+                    writeCompleteCallback_, shared_from_this()));
+            }
+        } else if (saveErrno != EWOULDBLOCK) {
+            LOG_ERROR(g_logger) << "sendBatchInLoop error: " << saveErrno;
+            if (saveErrno == EPIPE || saveErrno == ECONNRESET) {
+                faultError = true;
+            }
+        }
+    }
+
+    if (faultError) {
+        // 连接异常 丢弃未发送的数据
+        outputBuffer_.retrieveAll();
+    } else if (outputBuffer_.readableBytes() > 0) {
+        // 如果旧的数据和未发送数据的长度之和大于高水位标记 则调用高水位回调
+        if (total >= highWaterMark_
+            && oldLen < highWaterMark_
+            && highWaterMarkCallback_) {
+            loop_->queueInLoop(std::bind(
+                highWaterMarkCallback_,
+                shared_from_this(),
+                total));
+        }
+        if (!channel_->isWriteEvent()) {
+            channel_->enableWriting();
+        }
+    }
+}
+
+void TcpConnection::sendRefInLoop(const void* message, size_t len, const ChainBuffer::ReleaseCallback& release) {
     ssize_t nwrote = 0, remaining = len;
     bool    faultError = false;
 
     if (state_ == kDisconnected) {
         LOG_ERROR(g_logger) << "disconnected, give up writing";
+        if (release) {
+            release();
+        }
         return;
     }
 
@@ -203,10 +364,25 @@ void TcpConnection::sendInLoop(const void* message, size_t len) {
                 oldLen + remaining));
         }
         // 将未发送的数据添加到输出缓冲区中 等待下一次EPLLOUT事件的到来 再进行发送
-        outputBuffer_.append(static_cast<const char*>(message) + nwrote, remaining);
+        if (release) {
+            outputBuffer_.appendRef(static_cast<const char*>(message) + nwrote, remaining, release);
+        } else {
+            outputBuffer_.append(static_cast<const char*>(message) + nwrote, remaining);
+        }
         if (!channel_->isWriteEvent()) {
             channel_->enableWriting();
         }
+    } else if (release) {
+        // 数据已全部写入内核或者连接异常 不再引用调用者的数据
+        release();
+    }
+}
+
+void TcpConnection::releaseIdleBuffers(Timestamp now, double idleSeconds) {
+    if (inputBuffer_.readableBytes() == 0
+        && inputBuffer_.internalCapacity() > Buffer::kCheapPrepend
+        && addTime(lastReceiveTime_, idleSeconds) < now) {
+        inputBuffer_.shrink(0);
     }
 }
 
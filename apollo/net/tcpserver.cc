@@ -1,9 +1,14 @@
 #include "tcpserver.h"
 #include "log.h"
+#include "scavenger.h"
+#include <algorithm>
 #include <functional>
 #include <strings.h>
 using namespace apollo;
 
+/// 扫描连接缓冲区的间隔 单位为秒
+static const double kBufferScanInterval = 5.0;
+
 static EventLoop* CheckLoopNotNull(EventLoop* loop) {
     if (loop == nullptr) {
         LOG_FATAL(g_logger) << "loop is null!";
@@ -21,7 +26,8 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& localAddr,
     , connectionCallback_()
     , messageCallback_()
     , started_(false)
-    , nextConnId_(1) {
+    , nextConnId_(1)
+    , idleBufferTimeout_(30.0) {
     accepter_->setNewConnectionCallback(std::bind(
         &TcpServer::newConnection, this,
         std::placeholders::_1,
@@ -29,6 +35,9 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& localAddr,
 }
 
 TcpServer::~TcpServer() {
+    if (started_) {
+        loop_->cancel(bufferScanTimer_);
+    }
     for (auto& item : connections_) {
         TcpConnectionPtr conn(item.second);
         item.second.reset();
@@ -46,6 +55,13 @@ void TcpServer::start() {
         started_ = true;
         // 启动线程池
         threadPool_->start(threadInitCallback_);
+        ioLoops_     = threadPool_->getAllLoop();
+        bufferBytes_ = std::make_shared<BufferBytes>(ioLoops_.size());
+        bufferScanTimer_ = loop_->runEvery(kBufferScanInterval, std::bind(&TcpServer::scanBuffers, this));
+#ifdef TCMALLOC
+        // 启动内存池的空闲页回收线程
+        Scavenger::getInstance()->start();
+#endif
         // 开启MainLoop上的监听客户端事件
         loop_->runInLoop(std::bind(&Accepter::listen, accepter_.get()));
     }
@@ -97,4 +113,38 @@ void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn) {
     connections_.erase(conn->name());
     EventLoop* ioLoop = conn->getLoop();
     ioLoop->queueInLoop(std::bind(&TcpConnection::connectDestoryed, conn));
-}
\ No newline at end of file
+}
+void TcpServer::scanBuffers() {
+    std::vector<std::vector<TcpConnectionPtr>> groups(ioLoops_.size());
+    for (auto& item : connections_) {
+        auto iter = std::find(ioLoops_.begin(), ioLoops_.end(), item.second->getLoop());
+        groups[iter - ioLoops_.begin()].push_back(item.second);
+    }
+
+    // 没有连接的SubLoop也要投递任务 以便将其统计值清零
+    double timeout = idleBufferTimeout_;
+    for (size_t i = 0; i < ioLoops_.size(); i++) {
+        std::shared_ptr<BufferBytes> bufferBytes = bufferBytes_;
+        ioLoops_[i]->queueInLoop([conns = std::move(groups[i]), bufferBytes, i, timeout]() {
+            Timestamp now   = Timestamp::now();
+            size_t    bytes = 0;
+            for (const TcpConnectionPtr& conn : conns) {
+                if (timeout > 0) {
+                    conn->releaseIdleBuffers(now, timeout);
+                }
+                bytes += conn->bufferBytes();
+            }
+            (*bufferBytes)[i].store(bytes, std::memory_order_relaxed);
+        });
+    }
+}
+
+size_t TcpServer::bufferBytes() const {
+    size_t bytes = 0;
+    if (bufferBytes_ != nullptr) {
+        for (const std::atomic<size_t>& loopBytes : *bufferBytes_) {
+            bytes += loopBytes.load(std::memory_order_relaxed);
+        }
+    }
+    return bytes;
+}
@@ -1,13 +1,49 @@
 #include "rpcprovider.h"
 #include "configparser.h"
 #include "log.h"
+#include "rpccontrollerimpl.h"
 #include "rpcheader.pb.h"
 #include "tcpserver.h"
 #include "zkclient.h"
+#ifdef TCMALLOC
+#include "concurrentalloc.h"
+#endif
+#include <google/protobuf/arena.h>
 #include <google/protobuf/descriptor.h>
 using namespace apollo;
 using namespace google::protobuf;
 
+/// Arena第一个内存块的大小 一页
+static const size_t kArenaStartBlock = 4 * 1024;
+/// Arena内存块大小的上限 超过后按此大小继续申请
+static const size_t kArenaMaxBlock = 64 * 1024;
+
+#ifdef TCMALLOC
+static void* arenaBlockAlloc(size_t size) {
+    return concurrentAlloc(size);
+}
+
+static void arenaBlockFree(void* ptr, size_t size) {
+    concurrentFree(ptr, size);
+}
+#endif
+
+/**
+ * @brief 为一次RPC调用创建Arena
+ * @details 请求、响应和控制器都在Arena上创建，调用结束时随Arena一起释放。
+ * Arena的内存块以页为单位从内存池申请，释放时已知大小，无需查找Span
+ */
+static Arena* newCallArena() {
+    ArenaOptions options;
+    options.start_block_size = kArenaStartBlock;
+    options.max_block_size   = kArenaMaxBlock;
+#ifdef TCMALLOC
+    options.block_alloc   = &arenaBlockAlloc;
+    options.block_dealloc = &arenaBlockFree;
+#endif
+    return new Arena(options);
+}
+
 RpcProvider::RpcProvider()
     : loop_(new EventLoop) {
 }
@@ -93,33 +129,42 @@ void RpcProvider::onMessage(const TcpConnectionPtr& conn,
     uint32_t headerSize = 0;
     message.copy(reinterpret_cast<char*>(&headerSize), 4, 0);
 
-    // 根据header_size读取数据头的原始字符流
-    std::string content = message.substr(4, headerSize);
+    // 数据头和参数直接在message上解析 不再复制
+    const char* content = message.data() + 4;
+    if (4 + static_cast<size_t>(headerSize) > message.size()) {
+        LOG_FMT_ERROR(g_rpclogger, "invalid rpc header size: %u", headerSize);
+        return;
+    }
+
+    // 本次调用用到的所有protobuf对象都在Arena上创建
+    Arena* arena = newCallArena();
 
     // 反序列化数据得到RPC请求的详细信息
-    RpcHeader   rpcHeader;
-    std::string serviceName, methodName;
-    uint32_t    argsSize = 0;
-    if (rpcHeader.ParseFromString(content)) {
-        serviceName = rpcHeader.service_name();
-        methodName  = rpcHeader.method_name();
-        argsSize    = rpcHeader.args_size();
-    } else {
-        LOG_FMT_ERROR(g_rpclogger, "failed to parse rpc header: %s",
-            content.c_str());
+    RpcHeader* rpcHeader = Arena::CreateMessage<RpcHeader>(arena);
+    if (!rpcHeader->ParseFromArray(content, headerSize)) {
+        LOG_FMT_ERROR(g_rpclogger, "failed to parse rpc header: %.*s",
+            static_cast<int>(headerSize), content);
+        delete arena;
         return;
     }
+    const std::string& serviceName = rpcHeader->service_name();
+    const std::string& methodName  = rpcHeader->method_name();
+    uint32_t           argsSize    = rpcHeader->args_size();
 
-    std::string argsStr = message.substr(4 + headerSize, argsSize);
+    const char* args = content + headerSize;
+    if (argsSize > message.size() - 4 - headerSize) {
+        argsSize = message.size() - 4 - headerSize;
+    }
 
-    LOG_FMT_DEBUG(g_rpclogger, "receive rpc header: [%d][%s][%s][%s][%d][%s]",
-        headerSize, content.c_str(), serviceName.c_str(),
-        methodName.c_str(), argsSize, argsStr.c_str());
+    LOG_FMT_DEBUG(g_rpclogger, "receive rpc header: [%d][%.*s][%s][%s][%d][%.*s]",
+        headerSize, static_cast<int>(headerSize), content, serviceName.c_str(),
+        methodName.c_str(), argsSize, static_cast<int>(argsSize), args);
 
     // 获取service对象和method对象
     auto iter = serviceMap_.find(serviceName);
     if (iter == serviceMap_.end()) {
         LOG_FMT_ERROR(g_rpclogger, "%s is not exist", serviceName.c_str());
+        delete arena;
         return;
     }
 
@@ -127,6 +172,7 @@ void RpcProvider::onMessage(const TcpConnectionPtr& conn,
     if (mt_iter == iter->second.methodMap.end()) {
         LOG_FMT_ERROR(g_rpclogger, "%s:%s is not exist",
             serviceName.c_str(), methodName.c_str());
+        delete arena;
         return;
     }
 
@@ -134,18 +180,22 @@ void RpcProvider::onMessage(const TcpConnectionPtr& conn,
     const MethodDescriptor* methodDesc = mt_iter->second;
 
     // 生成RPC方法调用的请求和响应
-    Message* request = service->GetRequestPrototype(methodDesc).New();
-    if (!request->ParseFromString(argsStr)) {
-        LOG_FMT_ERROR(g_rpclogger, "request parse error: %s", argsStr.c_str());
+    Message* request = service->GetRequestPrototype(methodDesc).New(arena);
+    if (!request->ParseFromArray(args, argsSize)) {
+        LOG_FMT_ERROR(g_rpclogger, "request parse error: %.*s",
+            static_cast<int>(argsSize), args);
+        delete arena;
         return;
     }
 
     // 根据远端RPC请求 调用当前RPC节点上发布的方法
-    Message* response = service->GetResponsePrototype(methodDesc).New();
-    Closure* done     = NewCallback<RpcProvider,
+    // 响应所在的Arena由sendRpcResponse释放
+    Message*           response   = service->GetResponsePrototype(methodDesc).New(arena);
+    RpcControllerImpl* controller = Arena::Create<RpcControllerImpl>(arena);
+    Closure*           done       = NewCallback<RpcProvider,
         const TcpConnectionPtr&, Message*>(
         this, &RpcProvider::sendRpcResponse, conn, response);
-    service->CallMethod(methodDesc, nullptr, request, response, done);
+    service->CallMethod(methodDesc, controller, request, response, done);
 }
 
 void RpcProvider::sendRpcResponse(const TcpConnectionPtr& conn, Message* response) {
@@ -154,9 +204,12 @@ void RpcProvider::sendRpcResponse(const TcpConnectionPtr& conn, Message* respons
     std::string responseStr;
     if (response->SerializeToString(&responseStr)) {
         // 通过网络将RPC方法执行的结果发送回RPC的调用方
-        conn->send(responseStr);
+        conn->send(std::move(responseStr));
     } else {
         LOG_ERROR(g_rpclogger) << "failed to serial string";
     }
     conn->shutdown(); // 由RPC提供方主动断开连接
+
+    // 本次调用的请求、响应和控制器一起释放
+    delete response->GetArena();
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+/**
+ * @file main.cc
+ * @brief 内存池与glibc malloc的对比基准测试
+ * @details 依次运行混合大小、跨线程释放以及大块内存三个场景，输出吞吐量、
+ * 每次申请和释放耗时的分位数以及驻留内存的峰值。同一进程中先测试的分配器缓存的内存不会被后测试的复用，
+ * 驻留内存的峰值以每个场景开始时为基准，如需严格对比可以分别只测试一种分配器
+ */
+
+#include "benchmark.h"
+#include "concurrentalloc.h"
+#include "mallocstats.h"
+#include <cstring>
+#include <iostream>
+#include <libgen.h>
+using namespace std;
+using namespace apollo;
+
+static void runAll(BenchAllocator allocator, size_t nops, size_t nworks) {
+    PrintBenchResult("size-mix", allocator, nworks, BenchmarkSizeMix(allocator, nops, nworks));
+    PrintBenchResult("producer-consumer", allocator, nworks, BenchmarkProducerConsumer(allocator, nops, nworks));
+    PrintBenchResult("large", allocator, nworks, BenchmarkLargeAlloc(allocator, nops / 100 + 1, nworks));
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 2) {
+        cout << "Usage: " << basename(argv[0]) << " op_count thread_count [malloc|apollo]" << endl;
+        return 0;
+    }
+    size_t      nops      = atoi(argv[1]);
+    size_t      threadcnt = atoi(argv[2]);
+    const char* which     = argc > 3 ? argv[3] : "";
+
+#ifdef APLOVERRIDEMALLOC
+    // malloc已被替换为内存池 malloc一侧的结果实际上测的也是内存池 没有对比意义
+    if (strcmp(which, "malloc") == 0) {
+        cout << "malloc is overridden by the mempool (APLOVERRIDEMALLOC), rebuild without it to benchmark glibc malloc"
+             << endl;
+        return 1;
+    }
+    cout << "malloc is overridden by the mempool (APLOVERRIDEMALLOC), skipping the malloc baseline" << endl;
+#else
+    if (strcmp(which, "apollo") != 0) {
+        runAll(BenchAllocator::MALLOC, nops, threadcnt);
+    }
+#endif
+    if (strcmp(which, "malloc") != 0) {
+        runAll(BenchAllocator::APOLLO, nops, threadcnt);
+#ifdef TCMALLOC
+        MallocStats stats;
+        MallocStats::collect(stats);
+        cout << stats.toString();
+#endif
+    }
+    return 0;
+}
@@ -48,7 +48,7 @@ private:
             request.SerializeToString(&requestStr);
 
             // 发送数据包
-            conn->send(requestStr);
+            conn->send(std::move(requestStr));
         } else {
             LOG_INFO(biz_logger) << "connection down";
             // loop_->quit();
@@ -84,7 +84,7 @@ private:
 
         std::string requestStr;
         request.SerializeToString(&requestStr);
-        conn->send(requestStr);
+        conn->send(std::move(requestStr));
 
         // LOG_FMT_INFO(biz_logger, "reve message: %s", message.c_str());
         // client->disconnect();
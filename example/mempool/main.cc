@@ -12,6 +12,7 @@
 #include <libgen.h>
 #include "benchmark.h"
 #include "concurrentalloc.h"
+#include "mallocstats.h"
 using namespace std;
 using namespace apollo;
 
@@ -34,6 +35,16 @@ int main(int argc, char* argv[]) {
     cout << endl
          << endl;
     BenchmarkConcurrentMalloc(n, threadcnt, 10);
+    cout << endl
+         << endl;
+    BenchmarkSizeClass(n * 100);
+    BenchmarkThreadCache(n * 100);
     cout << "=============" << endl;
+
+#ifdef TCMALLOC
+    MallocStats stats;
+    MallocStats::collect(stats);
+    cout << stats.toString();
+#endif
     return 0;
 }
@@ -57,7 +57,7 @@ private:
         std::string responseStr;
         response.SerializeToString(&responseStr);
 
-        conn->send(responseStr);
+        conn->send(std::move(responseStr));
         // conn->shutdown();
         // LOG_INFO(biz_logger) << "close write";
     }